@@ -1277,14 +1277,32 @@ static uint8_t alfs_is_cp_blk(struct f2fs_sb_info *sbi, block_t lblkaddr)
 	return 0;
 }
 
-void alfs_submit_bio(struct f2fs_sb_info *sbi, int rw, struct bio *bio, uint8_t sync)
+/*
+ * Only CP block writes under cp_mutex come from write_checkpoint(), so
+ * only their mapping writes count as a checkpoint phase.
+ */
+static void alfs_map_cp_blk(struct f2fs_sb_info *sbi, struct bio *bio)
 {
-	block_t lblkaddr = bio->bi_iter.bi_sector * 512 / 4096;
+	ktime_t start;
 
-	if (alfs_is_cp_blk(sbi, lblkaddr)) {
+	if (!op_is_write(bio_op(bio)) || !mutex_is_locked(&sbi->cp_mutex)) {
 		alfs_write_mapping_entries(sbi);
+		return;
 	}
 
+	start = ktime_get();
+	alfs_write_mapping_entries(sbi);
+	sbi->cp_phase_us[CP_PHASE_ALFS_MAP] +=
+			ktime_us_delta(ktime_get(), start);
+}
+
+void alfs_submit_bio(struct f2fs_sb_info *sbi, int rw, struct bio *bio, uint8_t sync)
+{
+	block_t lblkaddr = bio->bi_iter.bi_sector * 512 / 4096;
+
+	if (alfs_is_cp_blk(sbi, lblkaddr))
+		alfs_map_cp_blk(sbi, bio);
+
 	if (is_valid_meta_lblkaddr(sbi, lblkaddr) == 0) {
 		/* if WRITE then */
 		if (bio_op(bio) == REQ_OP_WRITE) {
@@ -1304,10 +1322,8 @@ void alfs_submit_merged_bio(struct f2fs_sb_info *sbi, int rw, struct bio *bio, u
 {
 	block_t lblkaddr = bio->bi_iter.bi_sector * 512 / 4096;
 
-	if (alfs_is_cp_blk(sbi, lblkaddr)) {
-		alfs_write_mapping_entries(sbi);
-	}
-
+	if (alfs_is_cp_blk(sbi, lblkaddr))
+		alfs_map_cp_blk(sbi, bio);
 
 	if (is_valid_meta_lblkaddr(sbi, lblkaddr) == 0) {
 		/* if WRITE then */
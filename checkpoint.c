@@ -940,6 +940,26 @@ int f2fs_sync_inode_meta(struct f2fs_sb_info *sbi)
 	return 0;
 }
 
+const char * const cp_reason_names[NR_CP_REASON] = {
+	"umount", "fastboot", "sync", "recovery", "discard",
+};
+
+const char * const cp_phase_names[NR_CP_PHASE] = {
+	"block_ops", "flush_nat", "flush_sit", "sync_meta", "cp_pack",
+	"wait", "commit", "prefree", "alfs_map", "total",
+};
+
+/* add the time since *start to a checkpoint phase and restart the clock */
+static void cp_phase_end(struct f2fs_sb_info *sbi, struct cp_control *cpc,
+					int phase, ktime_t *start)
+{
+	ktime_t now = ktime_get();
+
+	sbi->cp_phase_us[phase] += ktime_us_delta(now, *start);
+	*start = now;
+	trace_f2fs_write_checkpoint(sbi->sb, cpc->reason, cp_phase_names[phase]);
+}
+
 /*
  * Freeze all the FS-operations for checkpoint.
  */
@@ -999,18 +1019,18 @@ static void unblock_operations(struct f2fs_sb_info *sbi)
 {
 	up_write(&sbi->node_write);
 
-	build_free_nids(sbi, false);
+	wake_up_nid_refill(sbi);
 	f2fs_unlock_all(sbi);
 }
 
-static void wait_on_all_pages_writeback(struct f2fs_sb_info *sbi)
+static void wait_on_pages_writeback(struct f2fs_sb_info *sbi, int type)
 {
 	DEFINE_WAIT(wait);
 
 	for (;;) {
 		prepare_to_wait(&sbi->cp_wait, &wait, TASK_UNINTERRUPTIBLE);
 
-		if (!get_pages(sbi, F2FS_WB_CP_DATA))
+		if (!get_pages(sbi, type))
 			break;
 
 		io_schedule_timeout(5*HZ);
@@ -1018,6 +1038,27 @@ static void wait_on_all_pages_writeback(struct f2fs_sb_info *sbi)
 	finish_wait(&sbi->cp_wait, &wait);
 }
 
+static void wait_on_all_pages_writeback(struct f2fs_sb_info *sbi)
+{
+	wait_on_pages_writeback(sbi, F2FS_WB_CP_DATA);
+	wait_on_pages_writeback(sbi, F2FS_WB_CP_NODE);
+}
+
+/*
+ * A snapshot checkpoint commits while operations run again, so it waits
+ * only for node and meta writeback, which stays bounded as long as it
+ * holds node_write. Its dentry and cold data were waited for before
+ * operations were unblocked.
+ */
+static void wait_on_cp_pages_writeback(struct f2fs_sb_info *sbi,
+						struct cp_control *cpc)
+{
+	if (cpc->cp_block)
+		wait_on_pages_writeback(sbi, F2FS_WB_CP_NODE);
+	else
+		wait_on_all_pages_writeback(sbi);
+}
+
 static void update_ckpt_flags(struct f2fs_sb_info *sbi, struct cp_control *cpc)
 {
 	unsigned long orphan_num = sbi->im[ORPHAN_INO].ino_num;
@@ -1049,9 +1090,11 @@ static void update_ckpt_flags(struct f2fs_sb_info *sbi, struct cp_control *cpc)
 	spin_unlock(&sbi->cp_lock);
 }
 
-static int do_checkpoint(struct f2fs_sb_info *sbi, struct cp_control *cpc)
+static int do_checkpoint(struct f2fs_sb_info *sbi, struct cp_control *cpc,
+							ktime_t *start)
 {
 	struct f2fs_checkpoint *ckpt = F2FS_CKPT(sbi);
+	struct f2fs_checkpoint *cp_block = ckpt;
 	struct f2fs_nm_info *nm_i = NM_I(sbi);
 	unsigned long orphan_num = sbi->im[ORPHAN_INO].ino_num;
 	nid_t last_nid = nm_i->next_scan_nid;
@@ -1064,13 +1107,18 @@ static int do_checkpoint(struct f2fs_sb_info *sbi, struct cp_control *cpc)
 	struct curseg_info *seg_i = CURSEG_I(sbi, CURSEG_HOT_NODE);
 	u64 kbytes_written;
 
-	/* Flush all the NAT/SIT pages */
+	/*
+	 * Flush all the NAT/SIT pages. They are not waited for here, but go
+	 * out along with the node pages still under writeback.
+	 */
 	while (get_pages(sbi, F2FS_DIRTY_META)) {
 		sync_meta_pages(sbi, META, LONG_MAX);
 		if (unlikely(f2fs_cp_error(sbi)))
 			return -EIO;
 	}
 
+	cp_phase_end(sbi, cpc, CP_PHASE_SYNC_META, start);
+
 	next_free_nid(sbi, &last_nid);
 
 	/*
@@ -1130,20 +1178,33 @@ static int do_checkpoint(struct f2fs_sb_info *sbi, struct cp_control *cpc)
 	get_sit_bitmap(sbi, __bitmap_ptr(sbi, SIT_BITMAP));
 	get_nat_bitmap(sbi, __bitmap_ptr(sbi, NAT_BITMAP));
 
-	crc32 = f2fs_crc32(sbi, ckpt, le32_to_cpu(ckpt->checksum_offset));
-	*((__le32 *)((unsigned char *)ckpt +
+	/*
+	 * A snapshot checkpoint commits after operations are unblocked, when
+	 * the ckpt flags may change again, so it writes both CP blocks from a
+	 * private copy.
+	 */
+	if (cpc->cp_block) {
+		spin_lock(&sbi->cp_lock);
+		memcpy(cpc->cp_block, ckpt, F2FS_BLKSIZE);
+		spin_unlock(&sbi->cp_lock);
+		cp_block = cpc->cp_block;
+	}
+
+	crc32 = f2fs_crc32(sbi, cp_block, le32_to_cpu(ckpt->checksum_offset));
+	*((__le32 *)((unsigned char *)cp_block +
 				le32_to_cpu(ckpt->checksum_offset)))
 				= cpu_to_le32(crc32);
 
 	start_blk = __start_cp_next_addr(sbi);
 
-	/* need to wait for end_io results */
-	wait_on_all_pages_writeback(sbi);
-	if (unlikely(f2fs_cp_error(sbi)))
-		return -EIO;
+	/* let the next mount skip rebuilding free/dirty segment maps */
+	if (cpc->reason == CP_UMOUNT && seg_summary_fits(sbi))
+		write_seg_summary(sbi, start_blk + sbi->blocks_per_seg -
+				seg_summary_blocks(sbi),
+				cur_cp_version(ckpt) | ((__u64)crc32 << 32));
 
 	/* write out checkpoint buffer at block 0 */
-	update_meta_page(sbi, ckpt, start_blk++);
+	update_meta_page(sbi, cp_block, start_blk++);
 
 	for (i = 1; i < 1 + cp_payload_blks; i++)
 		update_meta_page(sbi, (char *)ckpt + i * F2FS_BLKSIZE,
@@ -1169,11 +1230,55 @@ static int do_checkpoint(struct f2fs_sb_info *sbi, struct cp_control *cpc)
 		start_blk += NR_CURSEG_NODE_TYPE;
 	}
 
-	/* writeout checkpoint block */
-	update_meta_page(sbi, ckpt, start_blk);
+	/* update user_block_counts */
+	sbi->last_valid_block_count = sbi->total_valid_block_count;
+	percpu_counter_set(&sbi->alloc_valid_block_count, 0);
+
+	release_ino_entry(sbi, false);
+
+	clear_sbi_flag(sbi, SBI_IS_DIRTY);
+	clear_sbi_flag(sbi, SBI_NEED_CP);
+
+	/*
+	 * redirty superblock if metadata like node page or inode cache is
+	 * updated during writing checkpoint.
+	 */
+	if (get_pages(sbi, F2FS_DIRTY_NODES) ||
+			get_pages(sbi, F2FS_DIRTY_IMETA))
+		set_sbi_flag(sbi, SBI_IS_DIRTY);
+
+	f2fs_bug_on(sbi, get_pages(sbi, F2FS_DIRTY_DENTS));
+
+	cp_phase_end(sbi, cpc, CP_PHASE_PACK, start);
+	return 0;
+}
+
+/*
+ * Write out the pack staged by do_checkpoint() and commit it with its last
+ * CP block. This does not look at any in-memory state other than the CP
+ * block itself, so a snapshot checkpoint runs it with operations unblocked.
+ */
+static int commit_checkpoint(struct f2fs_sb_info *sbi, struct cp_control *cpc,
+							ktime_t *start)
+{
+	struct f2fs_checkpoint *ckpt = F2FS_CKPT(sbi);
+	struct f2fs_checkpoint *cp_block = cpc->cp_block ? cpc->cp_block : ckpt;
+	block_t start_blk = __start_cp_next_addr(sbi) +
+			le32_to_cpu(ckpt->cp_pack_total_block_count) - 1;
+
+	/*
+	 * The CP pack body, orphan and summary blocks are contiguous, so they
+	 * go out as one merged bio. Only the last CP block, which commits the
+	 * pack, has to wait for everything before it.
+	 */
+	while (get_pages(sbi, F2FS_DIRTY_META)) {
+		sync_meta_pages(sbi, META, LONG_MAX);
+		if (unlikely(f2fs_cp_error(sbi)))
+			return -EIO;
+	}
 
 	/* wait for previous submitted node/meta pages writeback */
-	wait_on_all_pages_writeback(sbi);
+	wait_on_cp_pages_writeback(sbi, cpc);
 
 	if (unlikely(f2fs_cp_error(sbi)))
 		return -EIO;
@@ -1181,36 +1286,64 @@ static int do_checkpoint(struct f2fs_sb_info *sbi, struct cp_control *cpc)
 	filemap_fdatawait_range(NODE_MAPPING(sbi), 0, LLONG_MAX);
 	filemap_fdatawait_range(META_MAPPING(sbi), 0, LLONG_MAX);
 
-	/* update user_block_counts */
-	sbi->last_valid_block_count = sbi->total_valid_block_count;
-	percpu_counter_set(&sbi->alloc_valid_block_count, 0);
+	cp_phase_end(sbi, cpc, CP_PHASE_WAIT, start);
 
-	/* Here, we only have one bio having CP pack */
+	/* writeout checkpoint block */
+	update_meta_page(sbi, cp_block, start_blk);
+
+	/* Here, we only have one bio having the last CP block */
 	sync_meta_pages(sbi, META_FLUSH, LONG_MAX);
 
 	/* wait for previous submitted meta pages writeback */
-	wait_on_all_pages_writeback(sbi);
-
-	release_ino_entry(sbi, false);
+	wait_on_cp_pages_writeback(sbi, cpc);
 
 	if (unlikely(f2fs_cp_error(sbi)))
 		return -EIO;
 
-	clear_sbi_flag(sbi, SBI_IS_DIRTY);
-	clear_sbi_flag(sbi, SBI_NEED_CP);
 	__set_cp_next_pack(sbi);
 
-	/*
-	 * redirty superblock if metadata like node page or inode cache is
-	 * updated during writing checkpoint.
-	 */
-	if (get_pages(sbi, F2FS_DIRTY_NODES) ||
-			get_pages(sbi, F2FS_DIRTY_IMETA))
-		set_sbi_flag(sbi, SBI_IS_DIRTY);
+	cp_phase_end(sbi, cpc, CP_PHASE_COMMIT, start);
+	return 0;
+}
 
-	f2fs_bug_on(sbi, get_pages(sbi, F2FS_DIRTY_DENTS));
+/*
+ * A snapshot checkpoint stages the whole pack under block_operations() and
+ * writes it after unblock_operations(). Until it commits, neither the blocks
+ * nor the segments freed by the last checkpoint may be reused, so it is only
+ * taken in lfs mode, where SSR and in-place updates never happen.
+ */
+static bool can_snapshot_checkpoint(struct f2fs_sb_info *sbi,
+						struct cp_control *cpc)
+{
+	int i;
 
-	return 0;
+	if (!test_opt(sbi, SNAPSHOT_CP) || !test_opt(sbi, LFS))
+		return false;
+	if (cpc->reason != CP_SYNC && cpc->reason != CP_FASTBOOT)
+		return false;
+
+	for (i = 0; i < NR_CURSEG_TYPE; i++)
+		if (curseg_alloc_type(sbi, i) != LFS)
+			return false;
+	return true;
+}
+
+static void report_slow_checkpoint(struct f2fs_sb_info *sbi,
+						struct cp_control *cpc)
+{
+	unsigned int total_ms = sbi->cp_phase_us[CP_PHASE_TOTAL] / 1000;
+	char buf[256];
+	int i, len = 0;
+
+	if (!sbi->slow_cp_ms || total_ms < sbi->slow_cp_ms)
+		return;
+
+	for (i = 0; i < CP_PHASE_TOTAL; i++)
+		len += scnprintf(buf + len, sizeof(buf) - len, " %s=%uus",
+				cp_phase_names[i], sbi->cp_phase_us[i]);
+
+	f2fs_msg(sbi->sb, KERN_WARNING, "slow checkpoint: reason=%s %ums:%s",
+			cp_reason_names[cpc->reason], total_ms, buf);
 }
 
 /*
@@ -1220,10 +1353,14 @@ int write_checkpoint(struct f2fs_sb_info *sbi, struct cp_control *cpc)
 {
 	struct f2fs_checkpoint *ckpt = F2FS_CKPT(sbi);
 	unsigned long long ckpt_ver;
+	ktime_t cp_start, start;
 	int err = 0;
 
 	mutex_lock(&sbi->cp_mutex);
 
+	cpc->prefree_map = NULL;
+	cpc->cp_block = NULL;
+
 	if (!is_sbi_flag_set(sbi, SBI_IS_DIRTY) &&
 		(cpc->reason == CP_FASTBOOT || cpc->reason == CP_SYNC ||
 		(cpc->reason == CP_DISCARD && !sbi->discard_blks)))
@@ -1239,26 +1376,41 @@ int write_checkpoint(struct f2fs_sb_info *sbi, struct cp_control *cpc)
 
 	trace_f2fs_write_checkpoint(sbi->sb, cpc->reason, "start block_ops");
 
+	memset(sbi->cp_phase_us, 0, sizeof(sbi->cp_phase_us));
+	cp_start = start = ktime_get();
+
 	err = block_operations(sbi);
 	if (err)
 		goto out;
 
-	trace_f2fs_write_checkpoint(sbi->sb, cpc->reason, "finish block_ops");
+	cp_phase_end(sbi, cpc, CP_PHASE_BLOCK_OPS, &start);
 
 	f2fs_flush_merged_bios(sbi);
 
 	/* this is the case of multiple fstrims without any changes */
 	if (cpc->reason == CP_DISCARD && !is_sbi_flag_set(sbi, SBI_IS_DIRTY)) {
-		f2fs_bug_on(sbi, NM_I(sbi)->dirty_nat_cnt);
+		f2fs_bug_on(sbi, dirty_nat_count(NM_I(sbi)));
 		f2fs_bug_on(sbi, SIT_I(sbi)->dirty_sentries);
 		f2fs_bug_on(sbi, prefree_segments(sbi));
 		flush_sit_entries(sbi, cpc);
 		clear_prefree_segments(sbi, cpc);
-		f2fs_wait_all_discard_bio(sbi);
+		f2fs_wait_discard_bio(sbi, NULL_ADDR);
 		unblock_operations(sbi);
 		goto out;
 	}
 
+	if (can_snapshot_checkpoint(sbi, cpc)) {
+		cpc->prefree_map = f2fs_kvzalloc(
+				f2fs_bitmap_size(MAIN_SEGS(sbi)), GFP_NOFS);
+		cpc->cp_block = kmalloc(F2FS_BLKSIZE, GFP_NOFS);
+		if (!cpc->prefree_map || !cpc->cp_block) {
+			kvfree(cpc->prefree_map);
+			kfree(cpc->cp_block);
+			cpc->prefree_map = NULL;
+			cpc->cp_block = NULL;
+		}
+	}
+
 	/*
 	 * update checkpoint pack index
 	 * Increase the version number so that
@@ -1269,20 +1421,59 @@ int write_checkpoint(struct f2fs_sb_info *sbi, struct cp_control *cpc)
 
 	/* write cached NAT/SIT entries to NAT/SIT area */
 	flush_nat_entries(sbi);
+	cp_phase_end(sbi, cpc, CP_PHASE_FLUSH_NAT, &start);
 	flush_sit_entries(sbi, cpc);
+	cp_phase_end(sbi, cpc, CP_PHASE_FLUSH_SIT, &start);
+
+	err = do_checkpoint(sbi, cpc, &start);
+
+	/*
+	 * The pack is staged in the meta cache, so let operations go once
+	 * the dentry and cold data of this checkpoint are on disk. Only
+	 * node_write is kept until the commit, so that no new node writeback
+	 * starts while it waits for the node pages of this checkpoint.
+	 */
+	if (cpc->prefree_map) {
+		down_write(&sbi->cp_commit_rwsem);
+		wait_on_pages_writeback(sbi, F2FS_WB_CP_DATA);
+		wake_up_nid_refill(sbi);
+		f2fs_unlock_all(sbi);
+		trace_f2fs_write_checkpoint(sbi->sb, cpc->reason,
+							"unblock snapshot");
+	}
+
+	if (!err)
+		err = commit_checkpoint(sbi, cpc, &start);
+
+	if (cpc->prefree_map) {
+		up_write(&sbi->node_write);
+		up_write(&sbi->cp_commit_rwsem);
+	}
 
-	/* unlock all the fs_lock[] in do_checkpoint() */
-	err = do_checkpoint(sbi, cpc);
 	if (err) {
 		release_discard_addrs(sbi);
 	} else {
 		clear_prefree_segments(sbi, cpc);
-		f2fs_wait_all_discard_bio(sbi);
+		/* the discard thread issues the rest in the background */
+		if (cpc->reason == CP_DISCARD || cpc->reason == CP_UMOUNT)
+			f2fs_wait_discard_bio(sbi, NULL_ADDR);
+		cp_phase_end(sbi, cpc, CP_PHASE_PREFREE, &start);
 	}
 
-	unblock_operations(sbi);
+	if (cpc->prefree_map) {
+		kvfree(cpc->prefree_map);
+		kfree(cpc->cp_block);
+		cpc->prefree_map = NULL;
+		cpc->cp_block = NULL;
+	} else {
+		unblock_operations(sbi);
+	}
 	stat_inc_cp_count(sbi->stat_info);
 
+	sbi->cp_phase_us[CP_PHASE_TOTAL] = ktime_us_delta(ktime_get(), cp_start);
+	f2fs_update_cp_stats(sbi, cpc->reason);
+	report_slow_checkpoint(sbi, cpc);
+
 	if (cpc->reason == CP_RECOVERY)
 		f2fs_msg(sbi->sb, KERN_NOTICE,
 			"checkpoint: version = %llx", ckpt_ver);
@@ -32,24 +32,24 @@
 #ifdef ALFS_SNAPSHOT
 #include "alfs_ext.h"
 #endif
-static bool __is_cp_guaranteed(struct page *page)
+static enum count_type __wb_data_type(struct page *page)
 {
 	struct address_space *mapping = page->mapping;
 	struct inode *inode;
 	struct f2fs_sb_info *sbi;
 
 	if (!mapping)
-		return false;
+		return F2FS_WB_DATA;
 
 	inode = mapping->host;
 	sbi = F2FS_I_SB(inode);
 
 	if (inode->i_ino == F2FS_META_INO(sbi) ||
-			inode->i_ino ==  F2FS_NODE_INO(sbi) ||
-			S_ISDIR(inode->i_mode) ||
-			is_cold_data(page))
-		return true;
-	return false;
+			inode->i_ino ==  F2FS_NODE_INO(sbi))
+		return F2FS_WB_CP_NODE;
+	if (S_ISDIR(inode->i_mode) || is_cold_data(page))
+		return F2FS_WB_CP_DATA;
+	return F2FS_WB_DATA;
 }
 
 static void f2fs_read_end_io(struct bio *bio)
@@ -106,7 +106,8 @@ static void f2fs_write_end_io(struct bio *bio)
 		clear_cold_data(page);
 		end_page_writeback(page);
 	}
-	if (!get_pages(sbi, F2FS_WB_CP_DATA) &&
+	if ((!get_pages(sbi, F2FS_WB_CP_DATA) ||
+				!get_pages(sbi, F2FS_WB_CP_NODE)) &&
 				wq_has_sleeper(&sbi->cp_wait))
 		wake_up(&sbi->cp_wait);
 
@@ -1861,6 +1862,7 @@ void f2fs_invalidate_page(struct page *page, unsigned int offset,
 			dec_page_count(sbi, F2FS_DIRTY_META);
 		} else if (inode->i_ino == F2FS_NODE_INO(sbi)) {
 			dec_page_count(sbi, F2FS_DIRTY_NODES);
+			clear_gc_node(page);
 		} else {
 			inode_dec_dirty_pages(inode);
 			remove_dirty_inode(inode);
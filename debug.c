@@ -50,7 +50,8 @@ static void update_general_status(struct f2fs_sb_info *sbi)
 	si->ndirty_files = sbi->ndirty_inode[FILE_INODE];
 	si->ndirty_all = sbi->ndirty_inode[DIRTY_META];
 	si->inmem_pages = get_pages(sbi, F2FS_INMEM_PAGES);
-	si->nr_wb_cp_data = get_pages(sbi, F2FS_WB_CP_DATA);
+	si->nr_wb_cp_data = get_pages(sbi, F2FS_WB_CP_DATA) +
+				get_pages(sbi, F2FS_WB_CP_NODE);
 	si->nr_wb_data = get_pages(sbi, F2FS_WB_DATA);
 	si->total_count = (int)sbi->user_block_count / sbi->blocks_per_seg;
 	si->rsvd_segs = reserved_segments(sbi);
@@ -71,12 +72,13 @@ static void update_general_status(struct f2fs_sb_info *sbi)
 	si->dirty_count = dirty_segments(sbi);
 	si->node_pages = NODE_MAPPING(sbi)->nrpages;
 	si->meta_pages = META_MAPPING(sbi)->nrpages;
-	si->nats = NM_I(sbi)->nat_cnt;
-	si->dirty_nats = NM_I(sbi)->dirty_nat_cnt;
+	si->nats = nat_cache_count(NM_I(sbi));
+	si->dirty_nats = dirty_nat_count(NM_I(sbi));
 	si->sits = MAIN_SEGS(sbi);
 	si->dirty_sits = SIT_I(sbi)->dirty_sentries;
 	si->free_nids = NM_I(sbi)->nid_cnt[FREE_NID_LIST];
 	si->alloc_nids = NM_I(sbi)->nid_cnt[ALLOC_NID_LIST];
+	memcpy(si->jstat, sbi->jstat, sizeof(si->jstat));
 	si->bg_gc = sbi->bg_gc;
 	si->util_free = (int)(free_user_blocks(sbi) >> sbi->log_blocks_per_seg)
 		* 100 / (int)(sbi->user_block_count >> sbi->log_blocks_per_seg)
@@ -162,6 +164,8 @@ static void update_mem_info(struct f2fs_sb_info *sbi)
 	if (f2fs_discard_en(sbi))
 		si->base_mem += SIT_VBLOCK_MAP_SIZE * MAIN_SEGS(sbi);
 	si->base_mem += SIT_VBLOCK_MAP_SIZE;
+	if (SIT_I(sbi)->lazy_segmap)
+		si->base_mem += f2fs_bitmap_size(MAIN_SEGS(sbi));
 	if (sbi->segs_per_sec > 1)
 		si->base_mem += MAIN_SECS(sbi) * sizeof(struct sec_entry);
 	si->base_mem += __bitmap_size(sbi, SIT_BITMAP);
@@ -169,7 +173,7 @@ static void update_mem_info(struct f2fs_sb_info *sbi)
 	/* build free segmap */
 	si->base_mem += sizeof(struct free_segmap_info);
 	si->base_mem += f2fs_bitmap_size(MAIN_SEGS(sbi));
-	si->base_mem += f2fs_bitmap_size(MAIN_SECS(sbi));
+	si->base_mem += 2 * f2fs_bitmap_size(MAIN_SECS(sbi));
 
 	/* build curseg */
 	si->base_mem += sizeof(struct curseg_info) * NR_CURSEG_TYPE;
@@ -183,13 +187,23 @@ static void update_mem_info(struct f2fs_sb_info *sbi)
 	/* build nm */
 	si->base_mem += sizeof(struct f2fs_nm_info);
 	si->base_mem += __bitmap_size(sbi, NAT_BITMAP);
+	si->base_mem += (NM_I(sbi)->nat_shard_mask + 1) *
+					sizeof(struct nat_cache_shard);
+	si->base_mem += NM_I(sbi)->nat_blocks * (NAT_ENTRY_BITMAP_SIZE +
+					sizeof(unsigned short));
+	si->base_mem += BITS_TO_LONGS(NM_I(sbi)->nat_blocks) *
+					sizeof(unsigned long);
+	si->base_mem += num_possible_cpus() * sizeof(struct free_nid_magazine);
 
 get_cache:
 	si->cache_mem = 0;
 
 	/* build gc */
-	if (sbi->gc_thread)
+	if (sbi->gc_thread) {
 		si->cache_mem += sizeof(struct f2fs_gc_kthread);
+		si->cache_mem += sbi->gc_thread->nr_workers *
+					sizeof(struct f2fs_gc_worker);
+	}
 
 	/* build merge flush thread */
 	if (SM_I(sbi)->cmd_control_info)
@@ -199,8 +213,11 @@ get_cache:
 	si->cache_mem += (NM_I(sbi)->nid_cnt[FREE_NID_LIST] +
 				NM_I(sbi)->nid_cnt[ALLOC_NID_LIST]) *
 				sizeof(struct free_nid);
-	si->cache_mem += NM_I(sbi)->nat_cnt * sizeof(struct nat_entry);
-	si->cache_mem += NM_I(sbi)->dirty_nat_cnt *
+	si->cache_mem += nat_cache_count(NM_I(sbi)) *
+					sizeof(struct nat_entry);
+	si->cache_mem += nat_block_count(NM_I(sbi)) *
+					sizeof(struct nat_block_cache);
+	si->cache_mem += dirty_nat_count(NM_I(sbi)) *
 					sizeof(struct nat_entry_set);
 	si->cache_mem += si->inmem_pages * sizeof(struct inmem_pages);
 	for (i = 0; i <= ORPHAN_INO; i++)
@@ -330,6 +347,16 @@ static int stat_show(struct seq_file *s, void *v)
 			   si->dirty_nats, si->nats, si->dirty_sits, si->sits);
 		seq_printf(s, "  - free_nids: %9d, alloc_nids: %9d\n",
 			   si->free_nids, si->alloc_nids);
+		for (j = 0; j < NR_JOURNAL_TYPE; j++) {
+			struct f2fs_journal_stat *js = &si->jstat[j];
+			unsigned long long total = js->jentries + js->bentries;
+
+			seq_printf(s, "  - %s journal hit: %llu%% "
+				"(journaled %llu, blocks %llu with %llu)\n",
+				j == NAT_JOURNAL ? "NAT" : "SIT",
+				total ? div64_u64(js->jentries * 100, total) : 0,
+				js->jentries, js->blocks, js->bentries);
+		}
 		seq_puts(s, "\nDistribution of User Blocks:");
 		seq_puts(s, " [ valid | invalid | free ]\n");
 		seq_puts(s, "  [");
@@ -384,6 +411,80 @@ static const struct file_operations stat_fops = {
 	.release = single_release,
 };
 
+void f2fs_update_cp_stats(struct f2fs_sb_info *sbi, int reason)
+{
+	struct f2fs_stat_info *si = F2FS_STAT(sbi);
+	int i;
+
+	for (i = 0; i < NR_CP_PHASE; i++) {
+		struct f2fs_cp_phase_stat *ps = &si->cp_phase[reason][i];
+		unsigned int us = sbi->cp_phase_us[i];
+		unsigned int ms = us / 1000;
+
+		if (!si->cp_reason_count[reason] || us < ps->min_us)
+			ps->min_us = us;
+		if (us > ps->max_us)
+			ps->max_us = us;
+		ps->total_us += us;
+		ps->hist[ms ? min_t(int, fls(ms), NR_CP_HIST - 1) : 0]++;
+	}
+	si->cp_reason_count[reason]++;
+}
+
+static int cp_latency_show(struct seq_file *s, void *v)
+{
+	struct f2fs_stat_info *si;
+	int i = 0;
+	int reason, phase, j;
+
+	mutex_lock(&f2fs_stat_mutex);
+	list_for_each_entry(si, &f2fs_stat_list, stat_list) {
+		seq_printf(s, "\n=====[ partition info(%pg). #%d ]=====\n",
+			si->sbi->sb->s_bdev, i++);
+
+		for (reason = 0; reason < NR_CP_REASON; reason++) {
+			unsigned int count = si->cp_reason_count[reason];
+
+			if (!count)
+				continue;
+
+			seq_printf(s, "\nCP reason: %s, count: %u\n",
+					cp_reason_names[reason], count);
+			seq_printf(s, "  %-10s %10s %10s %10s  %s\n", "phase",
+					"min(us)", "avg(us)", "max(us)",
+					"<1ms <2ms <4ms ... <1024ms >=1024ms");
+
+			for (phase = 0; phase < NR_CP_PHASE; phase++) {
+				struct f2fs_cp_phase_stat *ps =
+					&si->cp_phase[reason][phase];
+
+				seq_printf(s, "  %-10s %10u %10llu %10u ",
+					cp_phase_names[phase], ps->min_us,
+					div_u64(ps->total_us, count),
+					ps->max_us);
+				for (j = 0; j < NR_CP_HIST; j++)
+					seq_printf(s, " %u", ps->hist[j]);
+				seq_putc(s, '\n');
+			}
+		}
+	}
+	mutex_unlock(&f2fs_stat_mutex);
+	return 0;
+}
+
+static int cp_latency_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, cp_latency_show, inode->i_private);
+}
+
+static const struct file_operations cp_latency_fops = {
+	.owner = THIS_MODULE,
+	.open = cp_latency_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
 int f2fs_build_stats(struct f2fs_sb_info *sbi)
 {
 	struct f2fs_super_block *raw_super = F2FS_RAW_SUPER(sbi);
@@ -442,13 +543,19 @@ int __init f2fs_create_root_stats(void)
 
 	file = debugfs_create_file("status", S_IRUGO, f2fs_debugfs_root,
 			NULL, &stat_fops);
-	if (!file) {
-		debugfs_remove(f2fs_debugfs_root);
-		f2fs_debugfs_root = NULL;
-		return -ENOMEM;
-	}
+	if (!file)
+		goto fail;
+
+	file = debugfs_create_file("cp_latency", S_IRUGO, f2fs_debugfs_root,
+			NULL, &cp_latency_fops);
+	if (!file)
+		goto fail;
 
 	return 0;
+fail:
+	debugfs_remove_recursive(f2fs_debugfs_root);
+	f2fs_debugfs_root = NULL;
+	return -ENOMEM;
 }
 
 void f2fs_destroy_root_stats(void)
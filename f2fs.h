@@ -83,6 +83,8 @@ extern char *fault_name[FAULT_MAX];
 #define F2FS_MOUNT_FAULT_INJECTION	0x00010000
 #define F2FS_MOUNT_ADAPTIVE		0x00020000
 #define F2FS_MOUNT_LFS			0x00040000
+#define F2FS_MOUNT_LAZY_SIT		0x00080000
+#define F2FS_MOUNT_SNAPSHOT_CP		0x00100000
 
 #define clear_opt(sbi, option)	(sbi->mount_opt.opt &= ~F2FS_MOUNT_##option)
 #define set_opt(sbi, option)	(sbi->mount_opt.opt |= F2FS_MOUNT_##option)
@@ -126,8 +128,26 @@ enum {
 	CP_SYNC,
 	CP_RECOVERY,
 	CP_DISCARD,
+	NR_CP_REASON,
 };
 
+/* phases of write_checkpoint() timed for the latency breakdown */
+enum {
+	CP_PHASE_BLOCK_OPS,	/* block_operations() */
+	CP_PHASE_FLUSH_NAT,	/* flush_nat_entries() */
+	CP_PHASE_FLUSH_SIT,	/* flush_sit_entries() */
+	CP_PHASE_SYNC_META,	/* submitting the NAT/SIT pages */
+	CP_PHASE_PACK,		/* building the CP pack */
+	CP_PHASE_WAIT,		/* writing the pack and waiting for it */
+	CP_PHASE_COMMIT,	/* writing the last CP block */
+	CP_PHASE_PREFREE,	/* freeing prefree segments and discards */
+	CP_PHASE_ALFS_MAP,	/* ALFS mapping write, part of the above */
+	CP_PHASE_TOTAL,
+	NR_CP_PHASE,
+};
+
+#define NR_CP_HIST		12	/* <1ms, <2ms, <4ms, ... >=1024ms */
+
 #define DEF_BATCHED_TRIM_SECTIONS	2
 #define BATCHED_TRIM_SEGMENTS(sbi)	\
 		(SM_I(sbi)->trim_sections * (sbi)->segs_per_sec)
@@ -142,6 +162,8 @@ struct cp_control {
 	__u64 trim_end;
 	__u64 trim_minlen;
 	__u64 trimmed;
+	unsigned long *prefree_map;	/* prefree segments of a snapshot cp */
+	struct f2fs_checkpoint *cp_block;	/* CP block of a snapshot cp */
 };
 
 /*
@@ -181,11 +203,39 @@ struct discard_entry {
 	int len;		/* # of consecutive blocks of the discard */
 };
 
-struct bio_entry {
-	struct list_head list;
-	struct bio *bio;
-	struct completion event;
-	int error;
+#define DEF_MAX_DISCARD_REQUEST		8	/* discards issued per round */
+#define DEF_MIN_DISCARD_ISSUE_TIME	50	/* 50 ms, if device is idle */
+#define DEF_MAX_DISCARD_ISSUE_TIME	60000	/* 60 s, if busy or no work */
+
+enum {
+	D_PREP,			/* queued, not issued yet */
+	D_SUBMIT,		/* bio submitted */
+	D_DONE,			/* bio completed */
+};
+
+/* for the list of discard extents handled by the discard thread */
+struct discard_cmd {
+	struct list_head list;		/* command list */
+	struct rb_node rb_node;		/* indexed by lstart */
+	struct block_device *bdev;	/* target device */
+	block_t lstart;			/* logical start address */
+	block_t len;			/* # of blocks to be discarded */
+	struct bio *bio;		/* bio, once submitted */
+	struct completion wait;		/* completion of the bio */
+	int state;			/* D_PREP, D_SUBMIT or D_DONE */
+	int error;			/* bio error */
+	int ref;			/* # of waiters, under cmd_lock */
+};
+
+struct discard_cmd_control {
+	struct task_struct *f2fs_issue_discard;	/* discard thread */
+	wait_queue_head_t discard_wait_queue;	/* waiting queue for wake-up */
+	struct mutex cmd_lock;			/* lock for the lists and root */
+	struct list_head discard_pend_list;	/* queued, not issued yet */
+	struct list_head discard_wait_list;	/* issued, to be released */
+	struct rb_root root;			/* commands sorted by lstart */
+	atomic_t discard_cmd_cnt;		/* # of commands in the list */
+	int discard_wake;			/* to wake up discard thread */
 };
 
 /* for the list of fsync inodes, used only during recovery */
@@ -231,6 +281,51 @@ static inline bool __has_cursum_space(struct f2fs_journal *journal,
 	return size <= MAX_SIT_JENTRIES(journal);
 }
 
+/*
+ * Update history of a NAT or SIT block across checkpoints. The heat is
+ * halved for every checkpoint the block stays clean.
+ */
+struct f2fs_journal_heat {
+	unsigned short last_cp;		/* low bits of cp version last dirtied */
+	unsigned char heat;		/* decaying update frequency */
+};
+
+#define JOURNAL_HEAT_STEP	64
+#define NR_JOURNAL_TYPE		2	/* NAT_JOURNAL and SIT_JOURNAL */
+
+static inline unsigned int update_journal_heat(struct f2fs_journal_heat *jh,
+						unsigned short cp_ver)
+{
+	unsigned short age = cp_ver - jh->last_cp;
+	unsigned int heat = age >= 8 ? 0 : jh->heat >> age;
+
+	heat = min_t(unsigned int, heat + JOURNAL_HEAT_STEP, U8_MAX);
+	jh->heat = heat;
+	jh->last_cp = cp_ver;
+	return heat;
+}
+
+/*
+ * Journal space goes to the sets with the most heat per entry, i.e. to
+ * sparse sets which get dirtied again and again.
+ */
+static inline int journal_set_cmp(unsigned int heat_a, unsigned int cnt_a,
+				unsigned int heat_b, unsigned int cnt_b)
+{
+	unsigned long long a = (unsigned long long)(heat_a + 1) * cnt_b;
+	unsigned long long b = (unsigned long long)(heat_b + 1) * cnt_a;
+
+	if (a > b)
+		return -1;
+	return a < b;
+}
+
+struct f2fs_journal_stat {
+	unsigned long long jentries;	/* entries flushed to the journal */
+	unsigned long long bentries;	/* entries flushed to blocks */
+	unsigned long long blocks;	/* blocks rewritten */
+};
+
 /*
  * ioctl commands
  */
@@ -249,6 +344,13 @@ static inline bool __has_cursum_space(struct f2fs_journal *journal,
 #define F2FS_IOC_DEFRAGMENT		_IO(F2FS_IOCTL_MAGIC, 8)
 #define F2FS_IOC_MOVE_RANGE		_IOWR(F2FS_IOCTL_MAGIC, 9,	\
 						struct f2fs_move_range)
+#define F2FS_IOC_GET_LIFETIME		_IOR(F2FS_IOCTL_MAGIC, 10, __u32)
+#define F2FS_IOC_SET_LIFETIME		_IOW(F2FS_IOCTL_MAGIC, 11, __u32)
+
+/* lifetime classes of file data, used by F2FS_IOC_{GET,SET}_LIFETIME */
+#define F2FS_LIFETIME_NORMAL		0	/* warm data log */
+#define F2FS_LIFETIME_SHORT		1	/* hot data log */
+#define F2FS_LIFETIME_LONG		2	/* cold data log */
 
 #define F2FS_IOC_SET_ENCRYPTION_POLICY	FS_IOC_SET_ENCRYPTION_POLICY
 #define F2FS_IOC_GET_ENCRYPTION_POLICY	FS_IOC_GET_ENCRYPTION_POLICY
@@ -406,6 +508,7 @@ struct f2fs_map_blocks {
 #define FADVISE_ENCRYPT_BIT	0x04
 #define FADVISE_ENC_NAME_BIT	0x08
 #define FADVISE_KEEP_SIZE_BIT	0x10
+#define FADVISE_HOT_BIT		0x20
 
 #define file_is_cold(inode)	is_file(inode, FADVISE_COLD_BIT)
 #define file_wrong_pino(inode)	is_file(inode, FADVISE_LOST_PINO_BIT)
@@ -420,9 +523,26 @@ struct f2fs_map_blocks {
 #define file_set_enc_name(inode) set_file(inode, FADVISE_ENC_NAME_BIT)
 #define file_keep_isize(inode)	is_file(inode, FADVISE_KEEP_SIZE_BIT)
 #define file_set_keep_isize(inode) set_file(inode, FADVISE_KEEP_SIZE_BIT)
+#define file_is_hot(inode)	is_file(inode, FADVISE_HOT_BIT)
+#define file_set_hot(inode)	set_file(inode, FADVISE_HOT_BIT)
+#define file_clear_hot(inode)	clear_file(inode, FADVISE_HOT_BIT)
 
 #define DEF_DIR_LEVEL		0
 
+/*
+ * Window of direct node ids below the indirect node resolved by the last
+ * get_dnode_of_data() which walked through one, so sequential lookups can
+ * go straight to the next direct node.
+ */
+#define NODE_CURSOR_NIDS	8
+
+struct node_cursor {
+	unsigned int level;		/* path level, 0 if not valid */
+	unsigned int path[2];		/* offsets down to the indirect node */
+	unsigned int start;		/* offset of nids[0] in that node */
+	nid_t nids[NODE_CURSOR_NIDS];	/* cached direct node ids */
+};
+
 struct f2fs_inode_info {
 	struct inode vfs_inode;		/* serve a vfs inode */
 	unsigned long i_flags;		/* keep an inode flags for ioctl */
@@ -448,6 +568,8 @@ struct f2fs_inode_info {
 	struct mutex inmem_lock;	/* lock for inmemory pages */
 	struct extent_tree *extent_tree;	/* cached extent_tree entry */
 	struct rw_semaphore dio_rwsem[2];/* avoid racing between dio and gc */
+	spinlock_t node_cursor_lock;	/* protect node_cursor */
+	struct node_cursor node_cursor;	/* last resolved node path */
 };
 
 static inline void get_extent_info(struct extent_info *ext,
@@ -516,6 +638,28 @@ enum nid_list {
 	MAX_NID_LIST,
 };
 
+/*
+ * The NAT cache is split into shards indexed by NAT block, so the entries
+ * of a nat_entry_set always live in one shard. Lookups walk nat_root under
+ * RCU and copy node_info under seqlock; everything else takes lock.
+ * nat_root holds dirty and recently changed entries and shadows the packed
+ * clean copies kept per NAT block in nat_block_root.
+ */
+struct nat_cache_shard {
+	struct radix_tree_root nat_root;/* root of the nat entry cache */
+	struct radix_tree_root nat_set_root;/* root of the nat set cache */
+	struct rw_semaphore lock;	/* protect trees, lists and counts */
+	seqlock_t seqlock;		/* protect node_info of entries */
+	struct list_head nat_entries;	/* cached nat entry list (clean) */
+	unsigned int nat_cnt;		/* the # of cached nat entries */
+	unsigned int dirty_nat_cnt;	/* total num of nat entries in set */
+	struct radix_tree_root nat_block_root;/* clean NAT blocks, packed */
+	struct list_head nat_blocks;	/* LRU of cached NAT blocks */
+	unsigned int nat_block_cnt;	/* the # of cached NAT blocks */
+} ____cacheline_aligned_in_smp;
+
+#define MAX_NAT_SHARDS		64
+
 struct f2fs_nm_info {
 	block_t nat_blkaddr;		/* base disk address of NAT */
 	nid_t max_nid;			/* maximum possible node ids */
@@ -526,12 +670,10 @@ struct f2fs_nm_info {
 	unsigned int dirty_nats_ratio;	/* control dirty nats ratio threshold */
 
 	/* NAT cache management */
-	struct radix_tree_root nat_root;/* root of the nat entry cache */
-	struct radix_tree_root nat_set_root;/* root of the nat set cache */
-	struct rw_semaphore nat_tree_lock;	/* protect nat_tree_lock */
-	struct list_head nat_entries;	/* cached nat entry list (clean) */
-	unsigned int nat_cnt;		/* the # of cached nat entries */
-	unsigned int dirty_nat_cnt;	/* total num of nat entries in set */
+	struct nat_cache_shard *nat_shards;	/* NAT cache, by NAT block */
+	unsigned int nat_shard_mask;	/* # of shards - 1 */
+	unsigned int nat_shrink_idx;	/* next shard to shrink */
+	struct rw_semaphore nat_tree_lock;	/* NAT pages/journal vs. cache */
 
 	/* free node ids management */
 	struct radix_tree_root free_nid_root;/* root of the free_nid cache */
@@ -539,10 +681,24 @@ struct f2fs_nm_info {
 	unsigned int nid_cnt[MAX_NID_LIST];	/* the number of free node id */
 	spinlock_t nid_list_lock;	/* protect nid lists ops */
 	struct mutex build_lock;	/* lock for build free nids */
+	struct free_nid_magazine __percpu *nid_mags;	/* per-cpu free nids */
+	struct task_struct *nid_refill_task;	/* free nid refill thread */
+	wait_queue_head_t nid_refill_wq;	/* refill thread waits here */
+	int nid_refill_wake;		/* wake up the refill thread */
+	unsigned int nid_low_wmark;	/* wake refill below this */
+	unsigned int nid_high_wmark;	/* refill up to this */
+	unsigned int sync_nid_builds;	/* # of alloc_nid() stalls */
+	unsigned int nat_blocks;	/* # of NAT blocks */
+	unsigned long *nat_block_bitmap;/* NAT blocks loaded in bitmaps */
+	char *free_nid_bitmap;		/* free nid bits of each NAT block */
+	unsigned short *free_nid_count;	/* # of free nid bits per NAT block */
 
 	/* for checkpoint */
 	char *nat_bitmap;		/* NAT bitmap pointer */
 	int bitmap_size;		/* bitmap size */
+	spinlock_t nat_bitmap_lock;	/* protect nat_bitmap updates */
+	struct workqueue_struct *nat_flush_wq;	/* parallel NAT flush */
+	struct f2fs_journal_heat *nat_heat;	/* NAT block update history */
 };
 
 /*
@@ -634,7 +790,6 @@ struct f2fs_sm_info {
 
 	/* for small discard management */
 	struct list_head discard_list;		/* 4KB discard list */
-	struct list_head wait_list;		/* linked with issued discard bio */
 	int nr_discards;			/* # of discards in the list */
 	int max_discards;			/* max. discards to be issued */
 
@@ -650,6 +805,9 @@ struct f2fs_sm_info {
 	/* for flush command control */
 	struct flush_cmd_control *cmd_control_info;
 
+	/* for discard command control */
+	struct discard_cmd_control *dcc_info;
+
 };
 
 /*
@@ -661,7 +819,7 @@ struct f2fs_sm_info {
  * f2fs monitors the number of several block types such as on-writeback,
  * dirty dentry blocks, dirty node blocks, and dirty meta blocks.
  */
-#define WB_DATA_TYPE(p)	(__is_cp_guaranteed(p) ? F2FS_WB_CP_DATA : F2FS_WB_DATA)
+#define WB_DATA_TYPE(p)	__wb_data_type(p)
 enum count_type {
 	F2FS_DIRTY_DENTS,
 	F2FS_DIRTY_DATA,
@@ -670,6 +828,7 @@ enum count_type {
 	F2FS_INMEM_PAGES,
 	F2FS_DIRTY_IMETA,
 	F2FS_WB_CP_DATA,
+	F2FS_WB_CP_NODE,
 	F2FS_WB_DATA,
 	NR_COUNT_TYPE,
 };
@@ -721,12 +880,15 @@ struct f2fs_bio_info {
 
 #define FDEV(i)				(sbi->devs[i])
 #define RDEV(i)				(raw_super->devs[i])
+#define ALL_DEVICES			(-1)	/* GC over the whole volume */
 struct f2fs_dev_info {
 	struct block_device *bdev;
 	char path[MAX_PATH_LEN];
 	unsigned int total_segments;
 	block_t start_blk;
 	block_t end_blk;
+	unsigned int last_victim[2];		/* per-device GC cursors */
+	struct mutex gc_mutex;			/* serialize GC of the device */
 #ifdef CONFIG_BLK_DEV_ZONED
 	unsigned int nr_blkz;			/* Total number of zones */
 	u8 *blkz_type;				/* Array of zones type */
@@ -805,7 +967,13 @@ struct f2fs_sb_info {
 	struct mutex cp_mutex;			/* checkpoint procedure lock */
 	struct rw_semaphore cp_rwsem;		/* blocking FS operations */
 	struct rw_semaphore node_write;		/* locking node writes */
+	struct rw_semaphore cp_commit_rwsem;	/* snapshot cp being committed */
+	struct llist_head fsync_list;		/* fsyncs waiting for a group */
+	struct mutex fsync_mutex;		/* one fsync group at a time */
 	wait_queue_head_t cp_wait;
+	unsigned int cp_phase_us[NR_CP_PHASE];	/* phases of the running cp */
+	unsigned int slow_cp_ms;		/* log slower checkpoints */
+	struct f2fs_journal_stat jstat[NR_JOURNAL_TYPE];	/* NAT/SIT */
 	unsigned long last_time[MAX_TIME];	/* to store time in jiffies */
 	long interval_time[MAX_TIME];		/* to store thresholds */
 
@@ -863,7 +1031,7 @@ struct f2fs_sb_info {
 	struct f2fs_mount_info mount_opt;	/* mount options */
 
 	/* for cleaning operations */
-	struct mutex gc_mutex;			/* mutex for GC */
+	struct rw_semaphore gc_lock;		/* shared by per-device GC */
 	struct f2fs_gc_kthread	*gc_thread;	/* GC thread */
 	unsigned int cur_victim_sec;		/* current victim section num */
 
@@ -966,13 +1134,17 @@ static inline bool f2fs_time_over(struct f2fs_sb_info *sbi, int type)
 	return time_after(jiffies, sbi->last_time[type] + interval);
 }
 
-static inline bool is_idle(struct f2fs_sb_info *sbi)
+static inline bool is_bdev_idle(struct block_device *bdev)
 {
-	struct block_device *bdev = sbi->sb->s_bdev;
 	struct request_queue *q = bdev_get_queue(bdev);
 	struct request_list *rl = &q->root_rl;
 
-	if (rl->count[BLK_RW_SYNC] || rl->count[BLK_RW_ASYNC])
+	return !rl->count[BLK_RW_SYNC] && !rl->count[BLK_RW_ASYNC];
+}
+
+static inline bool is_idle(struct f2fs_sb_info *sbi)
+{
+	if (!is_bdev_idle(sbi->sb->s_bdev))
 		return 0;
 
 	return f2fs_time_over(sbi, REQ_TIME);
@@ -1104,6 +1276,13 @@ static inline unsigned long long cur_cp_version(struct f2fs_checkpoint *cp)
 	return le64_to_cpu(cp->checkpoint_ver);
 }
 
+static inline __u64 cur_cp_crc(struct f2fs_checkpoint *cp)
+{
+	size_t crc_offset = le32_to_cpu(cp->checksum_offset);
+
+	return le32_to_cpu(*((__le32 *)((unsigned char *)cp + crc_offset)));
+}
+
 static inline bool __is_set_ckpt_flags(struct f2fs_checkpoint *cp, unsigned int f)
 {
 	unsigned int ckpt_flags = le32_to_cpu(cp->ckpt_flags);
@@ -1271,7 +1450,8 @@ static inline void inc_page_count(struct f2fs_sb_info *sbi, int count_type)
 	atomic_inc(&sbi->nr_pages[count_type]);
 
 	if (count_type == F2FS_DIRTY_DATA || count_type == F2FS_INMEM_PAGES ||
-		count_type == F2FS_WB_CP_DATA || count_type == F2FS_WB_DATA)
+		count_type == F2FS_WB_CP_DATA ||
+		count_type == F2FS_WB_CP_NODE || count_type == F2FS_WB_DATA)
 		return;
 
 	set_sbi_flag(sbi, SBI_IS_DIRTY);
@@ -2100,8 +2280,11 @@ struct page *get_node_page_ra(struct page *parent, int start);
 void move_node_page(struct page *node_page, int gc_type);
 int fsync_node_pages(struct f2fs_sb_info *sbi, struct inode *inode,
 			struct writeback_control *wbc, bool atomic);
+int fsync_node_pages_group(struct f2fs_sb_info *sbi, struct inode **inodes,
+			int nr, struct writeback_control *wbc);
 int sync_node_pages(struct f2fs_sb_info *sbi, struct writeback_control *wbc);
 void build_free_nids(struct f2fs_sb_info *sbi, bool sync);
+void wake_up_nid_refill(struct f2fs_sb_info *sbi);
 bool alloc_nid(struct f2fs_sb_info *sbi, nid_t *nid);
 void alloc_nid_done(struct f2fs_sb_info *sbi, nid_t nid);
 void alloc_nid_failed(struct f2fs_sb_info *sbi, nid_t nid);
@@ -2132,7 +2315,8 @@ void destroy_flush_cmd_control(struct f2fs_sb_info *sbi, bool free);
 void invalidate_blocks(struct f2fs_sb_info *sbi, block_t addr);
 bool is_checkpointed_data(struct f2fs_sb_info *sbi, block_t blkaddr);
 void refresh_sit_entry(struct f2fs_sb_info *sbi, block_t old, block_t new);
-void f2fs_wait_all_discard_bio(struct f2fs_sb_info *sbi);
+void load_seg_entry(struct f2fs_sb_info *sbi, unsigned int segno);
+void f2fs_wait_discard_bio(struct f2fs_sb_info *sbi, block_t blkaddr);
 void clear_prefree_segments(struct f2fs_sb_info *sbi, struct cp_control *cpc);
 void release_discard_addrs(struct f2fs_sb_info *sbi);
 int npages_for_summary_flush(struct f2fs_sb_info *sbi, bool for_ra);
@@ -2160,6 +2344,7 @@ void f2fs_wait_on_encrypted_page_writeback(struct f2fs_sb_info *sbi,
 			block_t blkaddr);
 void write_data_summaries(struct f2fs_sb_info *sbi, block_t start_blk);
 void write_node_summaries(struct f2fs_sb_info *sbi, block_t start_blk);
+void write_seg_summary(struct f2fs_sb_info *sbi, block_t start_blk, __u64 cp_ver);
 int lookup_journal_in_cursum(struct f2fs_journal *journal, int type,
 			unsigned int val, int alloc);
 void flush_sit_entries(struct f2fs_sb_info *sbi, struct cp_control *cpc);
@@ -2196,6 +2381,8 @@ void update_dirty_page(struct inode *inode, struct page *page);
 void remove_dirty_inode(struct inode *inode);
 int sync_dirty_inodes(struct f2fs_sb_info *sbi, enum inode_type type);
 int write_checkpoint(struct f2fs_sb_info *sbi, struct cp_control *cpc);
+extern const char * const cp_reason_names[NR_CP_REASON];
+extern const char * const cp_phase_names[NR_CP_PHASE];
 void init_ino_entry_info(struct f2fs_sb_info *sbi);
 int __init create_checkpoint_caches(void);
 void destroy_checkpoint_caches(void);
@@ -2249,7 +2436,7 @@ int f2fs_migrate_page(struct address_space *mapping,
 int start_gc_thread(struct f2fs_sb_info *sbi);
 void stop_gc_thread(struct f2fs_sb_info *sbi);
 block_t start_bidx_of_node(unsigned int node_ofs, struct inode *inode);
-int f2fs_gc(struct f2fs_sb_info *sbi, bool sync, bool background);
+int f2fs_gc(struct f2fs_sb_info *sbi, bool sync, bool background, int devi);
 void build_gc_manager(struct f2fs_sb_info *sbi);
 
 /*
@@ -2262,6 +2449,12 @@ bool space_for_roll_forward(struct f2fs_sb_info *sbi);
  * debug.c
  */
 #ifdef CONFIG_F2FS_STAT_FS
+struct f2fs_cp_phase_stat {
+	unsigned long long total_us;
+	unsigned int min_us, max_us;
+	unsigned int hist[NR_CP_HIST];
+};
+
 struct f2fs_stat_info {
 	struct list_head stat_list;
 	struct f2fs_sb_info *sbi;
@@ -2274,6 +2467,7 @@ struct f2fs_stat_info {
 	int inmem_pages;
 	unsigned int ndirty_dirs, ndirty_files, ndirty_all;
 	int nats, dirty_nats, sits, dirty_sits, free_nids, alloc_nids;
+	struct f2fs_journal_stat jstat[NR_JOURNAL_TYPE];
 	int total_count, utilization;
 	int bg_gc, nr_wb_cp_data, nr_wb_data;
 	int inline_xattr, inline_inode, inline_dir, orphans;
@@ -2295,6 +2489,10 @@ struct f2fs_stat_info {
 	unsigned int block_count[2];
 	unsigned int inplace_count;
 	unsigned long long base_mem, cache_mem, page_mem;
+
+	/* checkpoint latency per reason and phase */
+	unsigned int cp_reason_count[NR_CP_REASON];
+	struct f2fs_cp_phase_stat cp_phase[NR_CP_REASON][NR_CP_PHASE];
 };
 
 static inline struct f2fs_stat_info *F2FS_STAT(struct f2fs_sb_info *sbi)
@@ -2380,6 +2578,7 @@ static inline struct f2fs_stat_info *F2FS_STAT(struct f2fs_sb_info *sbi)
 		si->bg_node_blks += (gc_type == BG_GC) ? (blks) : 0;	\
 	} while (0)
 
+void f2fs_update_cp_stats(struct f2fs_sb_info *sbi, int reason);
 int f2fs_build_stats(struct f2fs_sb_info *sbi);
 void f2fs_destroy_stats(struct f2fs_sb_info *sbi);
 int __init f2fs_create_root_stats(void);
@@ -2409,6 +2608,8 @@ void f2fs_destroy_root_stats(void);
 #define stat_inc_data_blk_count(sbi, blks, gc_type)
 #define stat_inc_node_blk_count(sbi, blks, gc_type)
 
+static inline void f2fs_update_cp_stats(struct f2fs_sb_info *sbi,
+							int reason) { }
 static inline int f2fs_build_stats(struct f2fs_sb_info *sbi) { return 0; }
 static inline void f2fs_destroy_stats(struct f2fs_sb_info *sbi) { }
 static inline int __init f2fs_create_root_stats(void) { return 0; }
@@ -177,6 +177,125 @@ static void try_to_fix_pino(struct inode *inode)
 	up_write(&fi->i_sem);
 }
 
+/* inodes looked up for every dirty node page in one group pass */
+#define FSYNC_GROUP_MAX		32
+
+struct fsync_group_cmd {
+	struct inode *inode;
+	bool pending;			/* nodes to be written in next pass */
+	int ret;
+	struct completion wait;
+	struct llist_node llnode;
+};
+
+static int __write_fsync_group(struct f2fs_sb_info *sbi,
+				struct llist_node *list)
+{
+	struct writeback_control wbc = {
+		.sync_mode = WB_SYNC_ALL,
+		.nr_to_write = LONG_MAX,
+		.for_reclaim = 0,
+	};
+	struct inode *inodes[FSYNC_GROUP_MAX];
+	struct fsync_group_cmd *cmd;
+	bool again;
+	int nr, ret = 0;
+
+write_nodes:
+	nr = 0;
+	llist_for_each_entry(cmd, list, llnode) {
+		if (!cmd->pending)
+			continue;
+		cmd->pending = false;
+		inodes[nr++] = cmd->inode;
+		if (nr == FSYNC_GROUP_MAX) {
+			ret = fsync_node_pages_group(sbi, inodes, nr, &wbc);
+			if (ret)
+				return ret;
+			nr = 0;
+		}
+	}
+	if (nr) {
+		ret = fsync_node_pages_group(sbi, inodes, nr, &wbc);
+		if (ret)
+			return ret;
+	}
+
+	/* if cp_error was enabled, we should avoid infinite loop */
+	if (unlikely(f2fs_cp_error(sbi)))
+		return -EIO;
+
+	again = false;
+	llist_for_each_entry(cmd, list, llnode) {
+		if (need_inode_block_update(sbi, cmd->inode->i_ino)) {
+			f2fs_mark_inode_dirty_sync(cmd->inode, true);
+			f2fs_write_inode(cmd->inode, NULL);
+			cmd->pending = again = true;
+		}
+	}
+	if (again)
+		goto write_nodes;
+
+	llist_for_each_entry(cmd, list, llnode) {
+		ret = wait_on_node_pages_writeback(sbi, cmd->inode->i_ino);
+		if (ret)
+			return ret;
+	}
+
+	return f2fs_issue_flush(sbi);
+}
+
+/*
+ * Concurrent fsyncs are committed in groups. The first caller to find the
+ * list empty leads the next group: it waits for the group in flight, takes
+ * everyone queued meanwhile, writes all their dnodes in one pass and ends
+ * them with a single cache flush. The others just wait for their leader.
+ */
+static int f2fs_fsync_group_commit(struct f2fs_sb_info *sbi,
+						struct inode *inode)
+{
+	struct fsync_group_cmd cmd = {
+		.inode = inode,
+		.pending = true,
+	};
+	struct fsync_group_cmd *c, *next;
+	struct llist_node *list;
+	int ret;
+
+	init_completion(&cmd.wait);
+
+	if (!llist_add(&cmd.llnode, &sbi->fsync_list)) {
+		wait_for_completion(&cmd.wait);
+		return cmd.ret;
+	}
+
+	mutex_lock(&sbi->fsync_mutex);
+	list = llist_del_all(&sbi->fsync_list);
+	list = llist_reverse_order(list);
+
+	ret = __write_fsync_group(sbi, list);
+
+	llist_for_each_entry(c, list, llnode) {
+		if (ret)
+			continue;
+		/* once recovery info is written, don't need to tack this */
+		remove_ino_entry(sbi, c->inode->i_ino, APPEND_INO);
+		clear_inode_flag(c->inode, FI_APPEND_WRITE);
+		remove_ino_entry(sbi, c->inode->i_ino, UPDATE_INO);
+		clear_inode_flag(c->inode, FI_UPDATE_WRITE);
+	}
+	if (!ret)
+		f2fs_update_time(sbi, REQ_TIME);
+	mutex_unlock(&sbi->fsync_mutex);
+
+	llist_for_each_entry_safe(c, next, list, llnode) {
+		c->ret = ret;
+		if (c != &cmd)
+			complete(&c->wait);
+	}
+	return ret;
+}
+
 static int f2fs_do_sync_file(struct file *file, loff_t start, loff_t end,
 						int datasync, bool atomic)
 {
@@ -250,6 +369,12 @@ go_write:
 		clear_inode_flag(inode, FI_UPDATE_WRITE);
 		goto out;
 	}
+
+	/* atomic writes need their own fsync mark on the last dnode */
+	if (!atomic) {
+		ret = f2fs_fsync_group_commit(sbi, inode);
+		goto out;
+	}
 sync_nodes:
 	ret = fsync_node_pages(sbi, inode, &wbc, atomic);
 	if (ret)
@@ -280,6 +405,14 @@ flush_out:
 	ret = f2fs_issue_flush(sbi);
 	f2fs_update_time(sbi, REQ_TIME);
 out:
+	/*
+	 * A snapshot checkpoint drops the ino entries it covers and stamps
+	 * node pages with its version early, so they count once it commits.
+	 */
+	if (test_opt(sbi, SNAPSHOT_CP)) {
+		down_read(&sbi->cp_commit_rwsem);
+		up_read(&sbi->cp_commit_rwsem);
+	}
 	trace_f2fs_sync_file_exit(inode, need_cp, datasync, ret);
 	f2fs_trace_ios(NULL, 1);
 	return ret;
@@ -1829,15 +1962,15 @@ static int f2fs_ioc_gc(struct file *filp, unsigned long arg)
 		return ret;
 
 	if (!sync) {
-		if (!mutex_trylock(&sbi->gc_mutex)) {
+		if (!down_write_trylock(&sbi->gc_lock)) {
 			ret = -EBUSY;
 			goto out;
 		}
 	} else {
-		mutex_lock(&sbi->gc_mutex);
+		down_write(&sbi->gc_lock);
 	}
 
-	ret = f2fs_gc(sbi, sync, true);
+	ret = f2fs_gc(sbi, sync, true, ALL_DEVICES);
 out:
 	mnt_drop_write_file(filp);
 	return ret;
@@ -2194,6 +2327,60 @@ err_out:
 	return err;
 }
 
+static int f2fs_ioc_get_lifetime(struct file *filp, unsigned long arg)
+{
+	struct inode *inode = file_inode(filp);
+	u32 lifetime = F2FS_LIFETIME_NORMAL;
+
+	if (file_is_hot(inode))
+		lifetime = F2FS_LIFETIME_SHORT;
+	else if (file_is_cold(inode))
+		lifetime = F2FS_LIFETIME_LONG;
+
+	return put_user(lifetime, (u32 __user *)arg);
+}
+
+static int f2fs_ioc_set_lifetime(struct file *filp, unsigned long arg)
+{
+	struct inode *inode = file_inode(filp);
+	u32 lifetime;
+	int ret;
+
+	if (!inode_owner_or_capable(inode))
+		return -EACCES;
+
+	if (!S_ISREG(inode->i_mode))
+		return -EINVAL;
+
+	if (get_user(lifetime, (u32 __user *)arg))
+		return -EFAULT;
+
+	if (lifetime > F2FS_LIFETIME_LONG)
+		return -EINVAL;
+
+	ret = mnt_want_write_file(filp);
+	if (ret)
+		return ret;
+
+	inode_lock(inode);
+
+	/* blocks written from now on go to the log of this class */
+	if (lifetime == F2FS_LIFETIME_SHORT)
+		file_set_hot(inode);
+	else
+		file_clear_hot(inode);
+
+	if (lifetime == F2FS_LIFETIME_LONG)
+		file_set_cold(inode);
+	else
+		file_clear_cold(inode);
+
+	inode_unlock(inode);
+
+	mnt_drop_write_file(filp);
+	return 0;
+}
+
 long f2fs_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 {
 	switch (cmd) {
@@ -2231,6 +2418,10 @@ long f2fs_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 		return f2fs_ioc_defragment(filp, arg);
 	case F2FS_IOC_MOVE_RANGE:
 		return f2fs_ioc_move_range(filp, arg);
+	case F2FS_IOC_GET_LIFETIME:
+		return f2fs_ioc_get_lifetime(filp, arg);
+	case F2FS_IOC_SET_LIFETIME:
+		return f2fs_ioc_set_lifetime(filp, arg);
 	default:
 		return -ENOTTY;
 	}
@@ -2295,6 +2486,8 @@ long f2fs_compat_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 	case F2FS_IOC_DEFRAGMENT:
 		break;
 	case F2FS_IOC_MOVE_RANGE:
+	case F2FS_IOC_GET_LIFETIME:
+	case F2FS_IOC_SET_LIFETIME:
 		break;
 	default:
 		return -ENOIOCTLCMD;
@@ -27,12 +27,99 @@
 #include "alfs_ext.h"
 #endif
 
+static u64 gc_kbytes_written(struct f2fs_sb_info *sbi)
+{
+	if (!sbi->sb->s_bdev->bd_part)
+		return 0;
+	return BD_PART_WRITTEN(sbi);
+}
+
+/*
+ * Sample device write throughput and free section consumption since the
+ * last wakeup, and estimate how long it takes to run out of free sections.
+ * Both rates are smoothed so that a single burst does not flip the pace.
+ */
+static void update_gc_pace(struct f2fs_sb_info *sbi)
+{
+	struct f2fs_gc_kthread *gc_th = sbi->gc_thread;
+	unsigned long now = jiffies;
+	unsigned int elapsed = jiffies_to_msecs(now - gc_th->last_sample);
+	unsigned int free_secs = free_sections(sbi);
+	unsigned int reserved_secs = reserved_sections(sbi);
+	u64 kbytes = gc_kbytes_written(sbi);
+	int consumed;
+	u64 rate;
+
+	if (!elapsed)
+		return;
+
+	rate = div_u64((kbytes - gc_th->last_kbytes) * MSEC_PER_SEC, elapsed);
+	gc_th->write_rate = (gc_th->write_rate * 3 +
+				(unsigned int)min_t(u64, rate, UINT_MAX)) / 4;
+
+	consumed = (int)gc_th->last_free_secs - (int)free_secs;
+	consumed = div_s64((s64)consumed * 60 * MSEC_PER_SEC, elapsed);
+	gc_th->consume_rate = (gc_th->consume_rate * 3 + consumed) / 4;
+
+	if (free_secs <= reserved_secs)
+		gc_th->time_to_full = 0;
+	else if (gc_th->consume_rate <= 0)
+		gc_th->time_to_full = GC_TIME_TO_FULL_INF;
+	else
+		gc_th->time_to_full = (free_secs - reserved_secs) * 60 /
+						gc_th->consume_rate;
+
+	gc_th->last_sample = now;
+	gc_th->last_free_secs = free_secs;
+	gc_th->last_kbytes = kbytes;
+}
+
+static bool is_gc_dev_idle(struct f2fs_sb_info *sbi, int devi)
+{
+	if (devi == ALL_DEVICES)
+		return is_idle(sbi);
+
+	/* other devices may be busy, as long as this one is not */
+	return is_bdev_idle(FDEV(devi).bdev);
+}
+
+/*
+ * A device of a multi-device volume is cleaned under gc_lock held for read
+ * and the gc_mutex of that device, so devices are cleaned in parallel.
+ * Cleaning the whole volume may checkpoint, so it takes gc_lock for write.
+ */
+static bool gc_trylock(struct f2fs_sb_info *sbi, int devi)
+{
+	if (devi == ALL_DEVICES)
+		return down_write_trylock(&sbi->gc_lock);
+
+	if (!down_read_trylock(&sbi->gc_lock))
+		return false;
+	if (mutex_trylock(&FDEV(devi).gc_mutex))
+		return true;
+	up_read(&sbi->gc_lock);
+	return false;
+}
+
+static void gc_unlock(struct f2fs_sb_info *sbi, int devi)
+{
+	if (devi == ALL_DEVICES) {
+		up_write(&sbi->gc_lock);
+		return;
+	}
+	mutex_unlock(&FDEV(devi).gc_mutex);
+	up_read(&sbi->gc_lock);
+}
+
 static int gc_thread_func(void *data)
 {
-	struct f2fs_sb_info *sbi = data;
+	struct f2fs_gc_worker *worker = data;
+	struct f2fs_sb_info *sbi = worker->sbi;
 	struct f2fs_gc_kthread *gc_th = sbi->gc_thread;
 	wait_queue_head_t *wq = &sbi->gc_thread->gc_wait_queue_head;
+	bool coordinator = (worker == &gc_th->workers[0]);
 	long wait_ms;
+	int devi;
 
 	wait_ms = gc_th->min_sleep_time;
 
@@ -56,6 +143,9 @@ static int gc_thread_func(void *data)
 			f2fs_stop_checkpoint(sbi, false);
 #endif
 
+		if (coordinator)
+			update_gc_pace(sbi);
+
 		/*
 		 * [GC triggering condition]
 		 * 0. GC is not conducted currently.
@@ -69,41 +159,59 @@ static int gc_thread_func(void *data)
 		 * invalidated soon after by user update or deletion.
 		 * So, I'd like to wait some time to collect dirty segments.
 		 */
-		if (!mutex_trylock(&sbi->gc_mutex))
+		devi = worker->devi;
+		if (test_opt(sbi, FORCE_FG_GC) ||
+				has_not_enough_free_secs(sbi, 0, 0))
+			devi = ALL_DEVICES;
+
+		if (!gc_trylock(sbi, devi))
 			continue;
 
-		if (!is_idle(sbi)) {
-			increase_sleep_time(gc_th, &wait_ms);
-			mutex_unlock(&sbi->gc_mutex);
+		if (!is_gc_dev_idle(sbi, devi)) {
+			backoff_sleep_time(gc_th, &wait_ms,
+						gc_pace_urgent(gc_th));
+			gc_unlock(sbi, devi);
 			continue;
 		}
 
-		if (has_enough_invalid_blocks(sbi))
-			decrease_sleep_time(gc_th, &wait_ms);
-		else
-			increase_sleep_time(gc_th, &wait_ms);
+		if (gc_pace_urgent(gc_th)) {
+			pace_sleep_time(gc_th, &wait_ms);
+		} else {
+			if (has_enough_invalid_blocks(sbi))
+				decrease_sleep_time(gc_th, &wait_ms);
+			else
+				increase_sleep_time(gc_th, &wait_ms);
+			stretch_sleep_time(gc_th, &wait_ms);
+		}
 
 		stat_inc_bggc_count(sbi);
 
 		/* if return value is not zero, no victim was selected */
-		if (f2fs_gc(sbi, test_opt(sbi, FORCE_FG_GC), true))
+		if (f2fs_gc(sbi, test_opt(sbi, FORCE_FG_GC), true, devi))
 			wait_ms = gc_th->no_gc_sleep_time;
 
 		trace_f2fs_background_gc(sbi->sb, wait_ms,
 				prefree_segments(sbi), free_segments(sbi));
 
 		/* balancing f2fs's metadata periodically */
-		f2fs_balance_fs_bg(sbi);
+		if (coordinator)
+			f2fs_balance_fs_bg(sbi);
 
 	} while (!kthread_should_stop());
 	return 0;
 }
 
+static void stop_gc_workers(struct f2fs_gc_kthread *gc_th, int nr)
+{
+	while (--nr >= 0)
+		kthread_stop(gc_th->workers[nr].f2fs_gc_task);
+}
+
 int start_gc_thread(struct f2fs_sb_info *sbi)
 {
 	struct f2fs_gc_kthread *gc_th;
 	dev_t dev = sbi->sb->s_bdev->bd_dev;
-	int err = 0;
+	int i, err = 0;
 
 	gc_th = f2fs_kmalloc(sbi, sizeof(struct f2fs_gc_kthread), GFP_KERNEL);
 	if (!gc_th) {
@@ -111,21 +219,62 @@ int start_gc_thread(struct f2fs_sb_info *sbi)
 		goto out;
 	}
 
+	/* clean each device of a multi-device volume in its own thread */
+	gc_th->nr_workers = sbi->s_ndevs > 1 ? sbi->s_ndevs : 1;
+	gc_th->workers = f2fs_kmalloc(sbi, gc_th->nr_workers *
+				sizeof(struct f2fs_gc_worker), GFP_KERNEL);
+	if (!gc_th->workers) {
+		err = -ENOMEM;
+		goto free_gc;
+	}
+
 	gc_th->min_sleep_time = DEF_GC_THREAD_MIN_SLEEP_TIME;
 	gc_th->max_sleep_time = DEF_GC_THREAD_MAX_SLEEP_TIME;
 	gc_th->no_gc_sleep_time = DEF_GC_THREAD_NOGC_SLEEP_TIME;
 
 	gc_th->gc_idle = 0;
 
+	gc_th->urgent_sleep_time = DEF_GC_THREAD_URGENT_SLEEP_TIME;
+	gc_th->lead_time = DEF_GC_LEAD_TIME;
+	gc_th->busy_write_rate = DEF_GC_BUSY_WRITE_RATE;
+	gc_th->last_sample = jiffies;
+	gc_th->last_free_secs = free_sections(sbi);
+	gc_th->last_kbytes = gc_kbytes_written(sbi);
+	gc_th->write_rate = 0;
+	gc_th->consume_rate = 0;
+	gc_th->time_to_full = GC_TIME_TO_FULL_INF;
+
 	sbi->gc_thread = gc_th;
 	init_waitqueue_head(&sbi->gc_thread->gc_wait_queue_head);
-	sbi->gc_thread->f2fs_gc_task = kthread_run(gc_thread_func, sbi,
-			"f2fs_gc-%u:%u", MAJOR(dev), MINOR(dev));
-	if (IS_ERR(gc_th->f2fs_gc_task)) {
-		err = PTR_ERR(gc_th->f2fs_gc_task);
-		kfree(gc_th);
-		sbi->gc_thread = NULL;
+
+	for (i = 0; i < gc_th->nr_workers; i++) {
+		struct f2fs_gc_worker *worker = &gc_th->workers[i];
+
+		worker->sbi = sbi;
+		if (gc_th->nr_workers == 1) {
+			worker->devi = ALL_DEVICES;
+			worker->f2fs_gc_task = kthread_run(gc_thread_func,
+					worker, "f2fs_gc-%u:%u",
+					MAJOR(dev), MINOR(dev));
+		} else {
+			worker->devi = i;
+			worker->f2fs_gc_task = kthread_run(gc_thread_func,
+					worker, "f2fs_gc-%u:%u-%d",
+					MAJOR(dev), MINOR(dev), i);
+		}
+		if (IS_ERR(worker->f2fs_gc_task)) {
+			err = PTR_ERR(worker->f2fs_gc_task);
+			stop_gc_workers(gc_th, i);
+			goto free_workers;
+		}
 	}
+	return 0;
+
+free_workers:
+	kfree(gc_th->workers);
+free_gc:
+	kfree(gc_th);
+	sbi->gc_thread = NULL;
 out:
 	return err;
 }
@@ -135,7 +284,8 @@ void stop_gc_thread(struct f2fs_sb_info *sbi)
 	struct f2fs_gc_kthread *gc_th = sbi->gc_thread;
 	if (!gc_th)
 		return;
-	kthread_stop(gc_th->f2fs_gc_task);
+	stop_gc_workers(gc_th, gc_th->nr_workers);
+	kfree(gc_th->workers);
 	kfree(gc_th);
 	sbi->gc_thread = NULL;
 }
@@ -254,16 +404,13 @@ static inline unsigned int get_gc_cost(struct f2fs_sb_info *sbi,
 		return get_cb_cost(sbi, segno);
 }
 
-static unsigned int count_bits(const unsigned long *addr,
-				unsigned int offset, unsigned int len)
+static void get_dev_segment_range(struct f2fs_sb_info *sbi, int devi,
+				unsigned int *start, unsigned int *end)
 {
-	unsigned int end = offset + len, sum = 0;
-
-	while (offset < end) {
-		if (test_bit(offset++, addr))
-			++sum;
-	}
-	return sum;
+	/* the first device also holds the metadata area */
+	*start = devi ? GET_SEGNO(sbi, FDEV(devi).start_blk) : 0;
+	*end = min_t(unsigned int, GET_SEGNO(sbi, FDEV(devi).end_blk) + 1,
+							MAIN_SEGS(sbi));
 }
 
 /*
@@ -275,12 +422,13 @@ static unsigned int count_bits(const unsigned long *addr,
  * which has minimum valid blocks and removes it from dirty seglist.
  */
 static int get_victim_by_default(struct f2fs_sb_info *sbi,
-		unsigned int *result, int gc_type, int type, char alloc_mode)
+		unsigned int *result, int gc_type, int type, char alloc_mode,
+		int devi)
 {
 	struct dirty_seglist_info *dirty_i = DIRTY_I(sbi);
 	struct victim_sel_policy p;
-	unsigned int secno, last_victim;
-	unsigned int last_segment = MAIN_SEGS(sbi);
+	unsigned int secno, last_victim, *cursor;
+	unsigned int first_segment = 0, last_segment = MAIN_SEGS(sbi);
 	unsigned int nsearched = 0;
 
 	mutex_lock(&dirty_i->seglist_lock);
@@ -294,7 +442,16 @@ static int get_victim_by_default(struct f2fs_sb_info *sbi,
 	if (p.max_search == 0)
 		goto out;
 
-	last_victim = sbi->last_victim[p.gc_mode];
+	cursor = &sbi->last_victim[p.gc_mode];
+	if (p.alloc_mode == LFS && devi != ALL_DEVICES) {
+		/* per-device GC only looks at its own range of segments */
+		get_dev_segment_range(sbi, devi, &first_segment,
+							&last_segment);
+		cursor = &FDEV(devi).last_victim[p.gc_mode];
+		p.offset = max(*cursor, first_segment);
+	}
+
+	last_victim = *cursor;
 	if (p.alloc_mode == LFS && gc_type == FG_GC) {
 		p.min_segno = check_bg_victims(sbi);
 		if (p.min_segno != NULL_SEGNO)
@@ -307,10 +464,10 @@ static int get_victim_by_default(struct f2fs_sb_info *sbi,
 
 		segno = find_next_bit(p.dirty_segmap, last_segment, p.offset);
 		if (segno >= last_segment) {
-			if (sbi->last_victim[p.gc_mode]) {
-				last_segment = sbi->last_victim[p.gc_mode];
-				sbi->last_victim[p.gc_mode] = 0;
-				p.offset = 0;
+			if (*cursor > first_segment) {
+				last_segment = *cursor;
+				*cursor = 0;
+				p.offset = first_segment;
 				continue;
 			}
 			break;
@@ -319,9 +476,8 @@ static int get_victim_by_default(struct f2fs_sb_info *sbi,
 		p.offset = segno + p.ofs_unit;
 		if (p.ofs_unit > 1) {
 			p.offset -= segno % p.ofs_unit;
-			nsearched += count_bits(p.dirty_segmap,
-						p.offset - p.ofs_unit,
-						p.ofs_unit);
+			nsearched += dirty_i->dirty_segs_in_sec[
+						GET_SECNO(sbi, segno)];
 		} else {
 			nsearched++;
 		}
@@ -342,10 +498,10 @@ static int get_victim_by_default(struct f2fs_sb_info *sbi,
 		}
 next:
 		if (nsearched >= p.max_search) {
-			if (!sbi->last_victim[p.gc_mode] && segno <= last_victim)
-				sbi->last_victim[p.gc_mode] = last_victim + 1;
+			if (!*cursor && segno <= last_victim)
+				*cursor = last_victim + 1;
 			else
-				sbi->last_victim[p.gc_mode] = segno + 1;
+				*cursor = segno + 1;
 			break;
 		}
 	}
@@ -418,6 +574,7 @@ static int check_valid_map(struct f2fs_sb_info *sbi,
 	int ret;
 
 	mutex_lock(&sit_i->sentry_lock);
+	load_seg_entry(sbi, segno);
 	sentry = get_seg_entry(sbi, segno);
 	ret = f2fs_test_bit(offset, sentry->cur_valid_map);
 	mutex_unlock(&sit_i->sentry_lock);
@@ -635,6 +792,7 @@ static void move_encrypted_block(struct inode *inode, block_t bidx,
 	fio.op = REQ_OP_WRITE;
 	fio.op_flags = REQ_SYNC;
 	fio.new_blkaddr = newaddr;
+	f2fs_wait_discard_bio(fio.sbi, newaddr);
 	f2fs_submit_page_mbio(&fio);
 
 	f2fs_update_data_blkaddr(&dn, newaddr);
@@ -824,14 +982,14 @@ next_step:
 }
 
 static int __get_victim(struct f2fs_sb_info *sbi, unsigned int *victim,
-			int gc_type)
+			int gc_type, int devi)
 {
 	struct sit_info *sit_i = SIT_I(sbi);
 	int ret;
 
 	mutex_lock(&sit_i->sentry_lock);
 	ret = DIRTY_I(sbi)->v_ops->get_victim(sbi, victim, gc_type,
-					      NO_CHECK_TYPE, LFS);
+					      NO_CHECK_TYPE, LFS, devi);
 	mutex_unlock(&sit_i->sentry_lock);
 	return ret;
 }
@@ -915,7 +1073,7 @@ next:
 	return sec_freed;
 }
 
-int f2fs_gc(struct f2fs_sb_info *sbi, bool sync, bool background)
+int f2fs_gc(struct f2fs_sb_info *sbi, bool sync, bool background, int devi)
 {
 	unsigned int segno;
 	int gc_type = sync ? FG_GC : BG_GC;
@@ -939,13 +1097,16 @@ gc_more:
 	}
 
 	if (gc_type == BG_GC && has_not_enough_free_secs(sbi, sec_freed, 0)) {
+		/* foreground GC cleans any device and needs gc_lock for write */
+		if (devi != ALL_DEVICES)
+			goto stop;
 		gc_type = FG_GC;
 		/*
 		 * If there is no victim and no prefree segment but still not
 		 * enough free sections, we should flush dent/node blocks and do
 		 * garbage collections.
 		 */
-		if (__get_victim(sbi, &segno, gc_type) ||
+		if (__get_victim(sbi, &segno, gc_type, devi) ||
 						prefree_segments(sbi)) {
 			ret = write_checkpoint(sbi, &cpc);
 			if (ret)
@@ -961,7 +1122,7 @@ gc_more:
 		goto stop;
 	}
 
-	if (segno == NULL_SEGNO && !__get_victim(sbi, &segno, gc_type))
+	if (segno == NULL_SEGNO && !__get_victim(sbi, &segno, gc_type, devi))
 		goto stop;
 	ret = 0;
 
@@ -980,7 +1141,7 @@ gc_more:
 			ret = write_checkpoint(sbi, &cpc);
 	}
 stop:
-	mutex_unlock(&sbi->gc_mutex);
+	gc_unlock(sbi, devi);
 
 	put_gc_inode(&gc_list);
 
@@ -16,16 +16,29 @@
 #define DEF_GC_THREAD_MIN_SLEEP_TIME	30000	/* milliseconds */
 #define DEF_GC_THREAD_MAX_SLEEP_TIME	60000
 #define DEF_GC_THREAD_NOGC_SLEEP_TIME	300000	/* wait 5 min */
+#define DEF_GC_THREAD_URGENT_SLEEP_TIME	500	/* fastest pace, in ms */
+#define DEF_GC_BUSY_WRITE_RATE		(32 * 1024)	/* KB/s, heavy writes */
+#define DEF_GC_LEAD_TIME		120	/* seconds of free space to keep */
+#define GC_TIME_TO_FULL_INF		UINT_MAX /* free space is not shrinking */
 #define LIMIT_INVALID_BLOCK	40 /* percentage over total user space */
 #define LIMIT_FREE_BLOCK	40 /* percentage over invalid + free space */
 
 /* Search max. number of dirty segments to select a victim segment */
 #define DEF_MAX_VICTIM_SEARCH 4096 /* covers 8GB */
 
-struct f2fs_gc_kthread {
+struct f2fs_gc_worker {
+	struct f2fs_sb_info *sbi;
 	struct task_struct *f2fs_gc_task;
+	int devi;			/* device to clean, or ALL_DEVICES */
+};
+
+struct f2fs_gc_kthread {
 	wait_queue_head_t gc_wait_queue_head;
 
+	/* one worker per device; the first one also paces GC for the fs */
+	int nr_workers;
+	struct f2fs_gc_worker *workers;
+
 	/* for gc sleep time */
 	unsigned int min_sleep_time;
 	unsigned int max_sleep_time;
@@ -33,6 +46,17 @@ struct f2fs_gc_kthread {
 
 	/* for changing gc mode */
 	unsigned int gc_idle;
+
+	/* for pacing gc ahead of free space consumption */
+	unsigned int urgent_sleep_time;	/* lower bound of paced sleep time */
+	unsigned int lead_time;		/* start pacing below this time_to_full */
+	unsigned int busy_write_rate;	/* stretch sleep above this KB/s */
+	unsigned long last_sample;	/* jiffies of the last sample */
+	unsigned int last_free_secs;	/* free sections at the last sample */
+	u64 last_kbytes;		/* kbytes written at the last sample */
+	unsigned int write_rate;	/* KB/s written to the device */
+	int consume_rate;		/* free sections consumed per minute */
+	unsigned int time_to_full;	/* seconds until free sections run out */
 };
 
 struct gc_inode_list {
@@ -75,6 +99,21 @@ static inline void increase_sleep_time(struct f2fs_gc_kthread *gc_th,
 		*wait = gc_th->max_sleep_time;
 }
 
+static inline void backoff_sleep_time(struct f2fs_gc_kthread *gc_th,
+						long *wait, bool urgent)
+{
+	unsigned int limit = urgent ? gc_th->min_sleep_time :
+					gc_th->max_sleep_time;
+
+	if (*wait == gc_th->no_gc_sleep_time)
+		return;
+
+	/* foreground I/O is active, so back off exponentially */
+	*wait *= 2;
+	if (*wait > limit)
+		*wait = limit;
+}
+
 static inline void decrease_sleep_time(struct f2fs_gc_kthread *gc_th,
 								long *wait)
 {
@@ -86,6 +125,44 @@ static inline void decrease_sleep_time(struct f2fs_gc_kthread *gc_th,
 		*wait = gc_th->min_sleep_time;
 }
 
+static inline bool gc_pace_urgent(struct f2fs_gc_kthread *gc_th)
+{
+	return gc_th->time_to_full < gc_th->lead_time;
+}
+
+/*
+ * Background GC cleans one section per wakeup, so sleep just long enough
+ * to reclaim sections a bit faster than foreground writes consume them.
+ */
+static inline void pace_sleep_time(struct f2fs_gc_kthread *gc_th, long *wait)
+{
+	unsigned int rate = max(gc_th->consume_rate, 0);
+
+	*wait = 60 * MSEC_PER_SEC / (rate + rate / 4 + 1);
+	if (*wait > gc_th->min_sleep_time)
+		*wait = gc_th->min_sleep_time;
+	if (*wait < gc_th->urgent_sleep_time)
+		*wait = gc_th->urgent_sleep_time;
+}
+
+/*
+ * Unless free space runs short, leave the device to heavy foreground
+ * writes, sleeping longer the more they exceed busy_write_rate.
+ */
+static inline void stretch_sleep_time(struct f2fs_gc_kthread *gc_th,
+								long *wait)
+{
+	u64 stretched;
+
+	if (*wait == gc_th->no_gc_sleep_time || !gc_th->busy_write_rate ||
+			gc_th->write_rate <= gc_th->busy_write_rate)
+		return;
+
+	stretched = div_u64((u64)*wait * gc_th->write_rate,
+						gc_th->busy_write_rate);
+	*wait = min_t(u64, stretched, gc_th->max_sleep_time);
+}
+
 static inline bool has_enough_invalid_blocks(struct f2fs_sb_info *sbi)
 {
 	block_t invalid_user_blocks = sbi->user_block_count -
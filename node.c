@@ -15,6 +15,7 @@
 #include <linux/blkdev.h>
 #include <linux/pagevec.h>
 #include <linux/swap.h>
+#include <linux/list_sort.h>
 
 #include "f2fs.h"
 #include "node.h"
@@ -25,6 +26,7 @@
 #define on_build_free_nids(nmi) mutex_is_locked(&nm_i->build_lock)
 
 static struct kmem_cache *nat_entry_slab;
+static struct kmem_cache *nat_block_slab;
 static struct kmem_cache *free_nid_slab;
 static struct kmem_cache *nat_entry_set_slab;
 
@@ -49,8 +51,9 @@ bool available_free_memory(struct f2fs_sb_info *sbi, int type)
 				sizeof(struct free_nid)) >> PAGE_SHIFT;
 		res = mem_size < ((avail_ram * nm_i->ram_thresh / 100) >> 2);
 	} else if (type == NAT_ENTRIES) {
-		mem_size = (nm_i->nat_cnt * sizeof(struct nat_entry)) >>
-							PAGE_SHIFT;
+		mem_size = (nat_cache_count(nm_i) * sizeof(struct nat_entry) +
+			nat_block_count(nm_i) * sizeof(struct nat_block_cache))
+							>> PAGE_SHIFT;
 		res = mem_size < ((avail_ram * nm_i->ram_thresh / 100) >> 2);
 		if (excess_cached_nats(sbi))
 			res = false;
@@ -127,31 +130,43 @@ static struct page *get_next_nat_page(struct f2fs_sb_info *sbi, nid_t nid)
 	set_page_dirty(dst_page);
 	f2fs_put_page(src_page, 1);
 
+	/* parallel nat flushes may share a byte of nat_bitmap */
+	spin_lock(&nm_i->nat_bitmap_lock);
 	set_to_next_nat(nm_i, nid);
+	spin_unlock(&nm_i->nat_bitmap_lock);
 
 	return dst_page;
 }
 
-static struct nat_entry *__lookup_nat_cache(struct f2fs_nm_info *nm_i, nid_t n)
+static struct nat_entry *__lookup_nat_cache(struct nat_cache_shard *shard,
+								nid_t n)
 {
-	return radix_tree_lookup(&nm_i->nat_root, n);
+	return radix_tree_lookup(&shard->nat_root, n);
 }
 
-static unsigned int __gang_lookup_nat_cache(struct f2fs_nm_info *nm_i,
+static unsigned int __gang_lookup_nat_cache(struct nat_cache_shard *shard,
 		nid_t start, unsigned int nr, struct nat_entry **ep)
 {
-	return radix_tree_gang_lookup(&nm_i->nat_root, (void **)ep, start, nr);
+	return radix_tree_gang_lookup(&shard->nat_root, (void **)ep, start, nr);
 }
 
-static void __del_from_nat_cache(struct f2fs_nm_info *nm_i, struct nat_entry *e)
+static void __free_nat_entry(struct rcu_head *head)
+{
+	kmem_cache_free(nat_entry_slab,
+			container_of(head, struct nat_entry, rcu_head));
+}
+
+static void __del_from_nat_cache(struct nat_cache_shard *shard,
+						struct nat_entry *e)
 {
 	list_del(&e->list);
-	radix_tree_delete(&nm_i->nat_root, nat_get_nid(e));
-	nm_i->nat_cnt--;
-	kmem_cache_free(nat_entry_slab, e);
+	radix_tree_delete(&shard->nat_root, nat_get_nid(e));
+	shard->nat_cnt--;
+	/* lockless lookups may still be reading it */
+	call_rcu(&e->rcu_head, __free_nat_entry);
 }
 
-static void __set_nat_cache_dirty(struct f2fs_nm_info *nm_i,
+static void __set_nat_cache_dirty(struct nat_cache_shard *shard,
 						struct nat_entry *ne)
 {
 	nid_t set = NAT_BLOCK_OFFSET(ne->ni.nid);
@@ -160,7 +175,7 @@ static void __set_nat_cache_dirty(struct f2fs_nm_info *nm_i,
 	if (get_nat_flag(ne, IS_DIRTY))
 		return;
 
-	head = radix_tree_lookup(&nm_i->nat_set_root, set);
+	head = radix_tree_lookup(&shard->nat_set_root, set);
 	if (!head) {
 		head = f2fs_kmem_cache_alloc(nat_entry_set_slab, GFP_NOFS);
 
@@ -168,141 +183,283 @@ static void __set_nat_cache_dirty(struct f2fs_nm_info *nm_i,
 		INIT_LIST_HEAD(&head->set_list);
 		head->set = set;
 		head->entry_cnt = 0;
-		f2fs_radix_tree_insert(&nm_i->nat_set_root, set, head);
+		f2fs_radix_tree_insert(&shard->nat_set_root, set, head);
 	}
 	list_move_tail(&ne->list, &head->entry_list);
-	nm_i->dirty_nat_cnt++;
+	shard->dirty_nat_cnt++;
 	head->entry_cnt++;
 	set_nat_flag(ne, IS_DIRTY, true);
 }
 
-static void __clear_nat_cache_dirty(struct f2fs_nm_info *nm_i,
+static void __clear_nat_cache_dirty(struct nat_cache_shard *shard,
 						struct nat_entry *ne)
 {
 	nid_t set = NAT_BLOCK_OFFSET(ne->ni.nid);
 	struct nat_entry_set *head;
 
-	head = radix_tree_lookup(&nm_i->nat_set_root, set);
+	head = radix_tree_lookup(&shard->nat_set_root, set);
 	if (head) {
-		list_move_tail(&ne->list, &nm_i->nat_entries);
+		list_move_tail(&ne->list, &shard->nat_entries);
 		set_nat_flag(ne, IS_DIRTY, false);
 		head->entry_cnt--;
-		nm_i->dirty_nat_cnt--;
+		shard->dirty_nat_cnt--;
 	}
 }
 
-static unsigned int __gang_lookup_nat_set(struct f2fs_nm_info *nm_i,
+static unsigned int __gang_lookup_nat_set(struct nat_cache_shard *shard,
 		nid_t start, unsigned int nr, struct nat_entry_set **ep)
 {
-	return radix_tree_gang_lookup(&nm_i->nat_set_root, (void **)ep,
+	return radix_tree_gang_lookup(&shard->nat_set_root, (void **)ep,
 							start, nr);
 }
 
-int need_dentry_mark(struct f2fs_sb_info *sbi, nid_t nid)
+static struct nat_block_cache *__lookup_nat_block(
+			struct nat_cache_shard *shard, nid_t nid)
 {
-	struct f2fs_nm_info *nm_i = NM_I(sbi);
+	return radix_tree_lookup(&shard->nat_block_root, NAT_BLOCK_OFFSET(nid));
+}
+
+static struct nat_block_entry *nat_block_entry(struct nat_block_cache *b,
+								nid_t nid)
+{
+	return &b->entries[nid - START_NID(nid)];
+}
+
+static void nat_block_get_info(struct nat_block_cache *b, nid_t nid,
+						struct node_info *ni)
+{
+	struct nat_block_entry *be = nat_block_entry(b, nid);
+
+	ni->nid = nid;
+	ni->ino = be->ino;
+	ni->blk_addr = be->blk_addr;
+	ni->version = be->version;
+	ni->flag = be->flag;
+}
+
+static void nat_block_set_info(struct nat_block_cache *b,
+						struct node_info *ni)
+{
+	struct nat_block_entry *be = nat_block_entry(b, ni->nid);
+
+	be->ino = ni->ino;
+	be->blk_addr = ni->blk_addr;
+	be->version = ni->version;
+	be->flag = ni->flag;
+}
+
+static void __free_nat_block(struct rcu_head *head)
+{
+	kmem_cache_free(nat_block_slab,
+			container_of(head, struct nat_block_cache, rcu_head));
+}
+
+static void __del_nat_block(struct nat_cache_shard *shard,
+					struct nat_block_cache *b)
+{
+	list_del(&b->list);
+	radix_tree_delete(&shard->nat_block_root, b->nat_ofs);
+	shard->nat_block_cnt--;
+	call_rcu(&b->rcu_head, __free_nat_block);
+}
+
+/*
+ * Look up a cached nat entry without taking the shard lock. Entries are
+ * published fully initialized and freed after an RCU grace period, and the
+ * shard seqlock keeps the copied node_info consistent with set_node_addr().
+ */
+static bool lookup_nat_cache_rcu(struct f2fs_nm_info *nm_i, nid_t nid,
+						struct node_info *ni)
+{
+	struct nat_cache_shard *shard = NAT_SHARD(nm_i, nid);
+	struct nat_block_cache *b = NULL;
 	struct nat_entry *e;
-	bool need = false;
+	unsigned int seq;
 
-	down_read(&nm_i->nat_tree_lock);
-	e = __lookup_nat_cache(nm_i, nid);
-	if (e) {
-		if (!get_nat_flag(e, IS_CHECKPOINTED) &&
-				!get_nat_flag(e, HAS_FSYNCED_INODE))
-			need = true;
+	rcu_read_lock();
+	e = __lookup_nat_cache(shard, nid);
+	if (!e)
+		b = __lookup_nat_block(shard, nid);
+	if (e || b) {
+		do {
+			seq = read_seqbegin(&shard->seqlock);
+			if (e)
+				*ni = e->ni;
+			else
+				nat_block_get_info(b, nid, ni);
+		} while (read_seqretry(&shard->seqlock, seq));
 	}
-	up_read(&nm_i->nat_tree_lock);
-	return need;
+	if (b && !READ_ONCE(b->referenced))
+		WRITE_ONCE(b->referenced, 1);
+	rcu_read_unlock();
+	return e || b;
+}
+
+static inline bool node_info_flag(struct node_info *ni, unsigned int type)
+{
+	return ni->flag & (0x01 << type);
+}
+
+int need_dentry_mark(struct f2fs_sb_info *sbi, nid_t nid)
+{
+	struct node_info ni;
+
+	return lookup_nat_cache_rcu(NM_I(sbi), nid, &ni) &&
+			!node_info_flag(&ni, IS_CHECKPOINTED) &&
+			!node_info_flag(&ni, HAS_FSYNCED_INODE);
 }
 
 bool is_checkpointed_node(struct f2fs_sb_info *sbi, nid_t nid)
 {
-	struct f2fs_nm_info *nm_i = NM_I(sbi);
-	struct nat_entry *e;
-	bool is_cp = true;
+	struct node_info ni;
 
-	down_read(&nm_i->nat_tree_lock);
-	e = __lookup_nat_cache(nm_i, nid);
-	if (e && !get_nat_flag(e, IS_CHECKPOINTED))
-		is_cp = false;
-	up_read(&nm_i->nat_tree_lock);
-	return is_cp;
+	return !lookup_nat_cache_rcu(NM_I(sbi), nid, &ni) ||
+			node_info_flag(&ni, IS_CHECKPOINTED);
 }
 
 bool need_inode_block_update(struct f2fs_sb_info *sbi, nid_t ino)
 {
-	struct f2fs_nm_info *nm_i = NM_I(sbi);
-	struct nat_entry *e;
-	bool need_update = true;
+	struct node_info ni;
 
-	down_read(&nm_i->nat_tree_lock);
-	e = __lookup_nat_cache(nm_i, ino);
-	if (e && get_nat_flag(e, HAS_LAST_FSYNC) &&
-			(get_nat_flag(e, IS_CHECKPOINTED) ||
-			 get_nat_flag(e, HAS_FSYNCED_INODE)))
-		need_update = false;
-	up_read(&nm_i->nat_tree_lock);
-	return need_update;
+	if (lookup_nat_cache_rcu(NM_I(sbi), ino, &ni) &&
+			node_info_flag(&ni, HAS_LAST_FSYNC) &&
+			(node_info_flag(&ni, IS_CHECKPOINTED) ||
+			 node_info_flag(&ni, HAS_FSYNCED_INODE)))
+		return false;
+	return true;
 }
 
-static struct nat_entry *grab_nat_entry(struct f2fs_nm_info *nm_i, nid_t nid,
-								bool no_fail)
+/*
+ * The new entry is filled in by @ni before it is inserted, since lockless
+ * lookups can find it as soon as it is in the tree.
+ */
+static struct nat_entry *grab_nat_entry(struct nat_cache_shard *shard,
+				struct node_info *ni, bool no_fail)
 {
 	struct nat_entry *new;
 
-	if (no_fail) {
+	if (no_fail)
 		new = f2fs_kmem_cache_alloc(nat_entry_slab, GFP_NOFS);
-		f2fs_radix_tree_insert(&nm_i->nat_root, nid, new);
-	} else {
+	else
 		new = kmem_cache_alloc(nat_entry_slab, GFP_NOFS);
-		if (!new)
-			return NULL;
-		if (radix_tree_insert(&nm_i->nat_root, nid, new)) {
-			kmem_cache_free(nat_entry_slab, new);
-			return NULL;
-		}
-	}
+	if (!new)
+		return NULL;
 
 	memset(new, 0, sizeof(struct nat_entry));
-	nat_set_nid(new, nid);
+	copy_node_info(&new->ni, ni);
 	nat_reset_flag(new);
-	list_add_tail(&new->list, &nm_i->nat_entries);
-	nm_i->nat_cnt++;
+
+	if (no_fail) {
+		f2fs_radix_tree_insert(&shard->nat_root, ni->nid, new);
+	} else if (radix_tree_insert(&shard->nat_root, ni->nid, new)) {
+		kmem_cache_free(nat_entry_slab, new);
+		return NULL;
+	}
+
+	list_add_tail(&new->list, &shard->nat_entries);
+	shard->nat_cnt++;
 	return new;
 }
 
-static void cache_nat_entry(struct f2fs_sb_info *sbi, nid_t nid,
-						struct f2fs_nat_entry *ne)
+static void cache_nat_entry(struct f2fs_sb_info *sbi, struct node_info *ni)
 {
-	struct f2fs_nm_info *nm_i = NM_I(sbi);
+	struct nat_cache_shard *shard = NAT_SHARD(NM_I(sbi), ni->nid);
 	struct nat_entry *e;
 
-	e = __lookup_nat_cache(nm_i, nid);
-	if (!e) {
-		e = grab_nat_entry(nm_i, nid, false);
-		if (e)
-			node_info_from_raw_nat(&e->ni, ne);
-	} else {
-		f2fs_bug_on(sbi, nat_get_ino(e) != le32_to_cpu(ne->ino) ||
-				nat_get_blkaddr(e) !=
-					le32_to_cpu(ne->block_addr) ||
-				nat_get_version(e) != ne->version);
+	down_write(&shard->lock);
+	e = __lookup_nat_cache(shard, ni->nid);
+	if (!e)
+		grab_nat_entry(shard, ni, false);
+	else
+		f2fs_bug_on(sbi, nat_get_ino(e) != ni->ino ||
+				nat_get_blkaddr(e) != ni->blk_addr ||
+				nat_get_version(e) != ni->version);
+	up_write(&shard->lock);
+}
+
+/*
+ * Build a packed copy of a whole NAT block, overlaid with the journal.
+ * Caller should hold nat_tree_lock, so that neither can change meanwhile.
+ */
+static struct nat_block_cache *build_nat_block(struct f2fs_sb_info *sbi,
+			struct f2fs_nat_block *nat_blk, nid_t start_nid)
+{
+	struct curseg_info *curseg = CURSEG_I(sbi, CURSEG_HOT_DATA);
+	struct f2fs_journal *journal = curseg->journal;
+	unsigned char flag = (0x01 << IS_CHECKPOINTED) |
+				(0x01 << HAS_LAST_FSYNC);
+	struct nat_block_cache *b;
+	int i;
+
+	b = kmem_cache_alloc(nat_block_slab, GFP_NOFS);
+	if (!b)
+		return NULL;
+
+	b->nat_ofs = NAT_BLOCK_OFFSET(start_nid);
+	b->referenced = 0;
+	for (i = 0; i < NAT_ENTRY_PER_BLOCK; i++) {
+		struct nat_block_entry *be = &b->entries[i];
+
+		be->ino = le32_to_cpu(nat_blk->entries[i].ino);
+		be->blk_addr = le32_to_cpu(nat_blk->entries[i].block_addr);
+		be->version = nat_blk->entries[i].version;
+		be->flag = flag;
 	}
+
+	down_read(&curseg->journal_rwsem);
+	for (i = 0; i < nats_in_cursum(journal); i++) {
+		nid_t nid = le32_to_cpu(nid_in_journal(journal, i));
+		struct f2fs_nat_entry *raw_ne = &nat_in_journal(journal, i);
+		struct nat_block_entry *be;
+
+		if (NAT_BLOCK_OFFSET(nid) != b->nat_ofs)
+			continue;
+		be = nat_block_entry(b, nid);
+		be->ino = le32_to_cpu(raw_ne->ino);
+		be->blk_addr = le32_to_cpu(raw_ne->block_addr);
+		be->version = raw_ne->version;
+	}
+	up_read(&curseg->journal_rwsem);
+	return b;
+}
+
+/* Caller should hold nat_tree_lock, as for build_nat_block(). */
+static void cache_nat_block(struct f2fs_sb_info *sbi,
+					struct nat_block_cache *b)
+{
+	nid_t start_nid = b->nat_ofs * NAT_ENTRY_PER_BLOCK;
+	struct nat_cache_shard *shard = NAT_SHARD(NM_I(sbi), start_nid);
+
+	down_write(&shard->lock);
+	if (__lookup_nat_block(shard, start_nid) ||
+			radix_tree_insert(&shard->nat_block_root,
+							b->nat_ofs, b)) {
+		up_write(&shard->lock);
+		kmem_cache_free(nat_block_slab, b);
+		return;
+	}
+	list_add_tail(&b->list, &shard->nat_blocks);
+	shard->nat_block_cnt++;
+	up_write(&shard->lock);
 }
 
 static void set_node_addr(struct f2fs_sb_info *sbi, struct node_info *ni,
 			block_t new_blkaddr, bool fsync_done)
 {
 	struct f2fs_nm_info *nm_i = NM_I(sbi);
+	struct nat_cache_shard *shard = NAT_SHARD(nm_i, ni->nid);
+	struct nat_block_cache *b;
 	struct nat_entry *e;
 
-	down_write(&nm_i->nat_tree_lock);
-	e = __lookup_nat_cache(nm_i, ni->nid);
+	down_write(&shard->lock);
+	e = __lookup_nat_cache(shard, ni->nid);
 	if (!e) {
-		e = grab_nat_entry(nm_i, ni->nid, true);
-		copy_node_info(&e->ni, ni);
+		e = grab_nat_entry(shard, ni, true);
 		f2fs_bug_on(sbi, ni->blk_addr == NEW_ADDR);
-	} else if (new_blkaddr == NEW_ADDR) {
+	}
+
+	write_seqlock(&shard->seqlock);
+	if (new_blkaddr == NEW_ADDR) {
 		/*
 		 * when nid is reallocated,
 		 * previous nat entry can be remained in nat cache.
@@ -336,38 +493,93 @@ static void set_node_addr(struct f2fs_sb_info *sbi, struct node_info *ni,
 	nat_set_blkaddr(e, new_blkaddr);
 	if (new_blkaddr == NEW_ADDR || new_blkaddr == NULL_ADDR)
 		set_nat_flag(e, IS_CHECKPOINTED, false);
-	__set_nat_cache_dirty(nm_i, e);
+	write_sequnlock(&shard->seqlock);
+	__set_nat_cache_dirty(shard, e);
 
 	/* update fsync_mark if its inode nat entry is still alive */
-	if (ni->nid != ni->ino)
-		e = __lookup_nat_cache(nm_i, ni->ino);
+	if (ni->nid != ni->ino) {
+		up_write(&shard->lock);
+		shard = NAT_SHARD(nm_i, ni->ino);
+		down_write(&shard->lock);
+		e = __lookup_nat_cache(shard, ni->ino);
+	}
 	if (e) {
+		write_seqlock(&shard->seqlock);
 		if (fsync_done && ni->nid == ni->ino)
 			set_nat_flag(e, HAS_FSYNCED_INODE, true);
 		set_nat_flag(e, HAS_LAST_FSYNC, fsync_done);
+		write_sequnlock(&shard->seqlock);
 	}
-	up_write(&nm_i->nat_tree_lock);
+
+	/* the packed copy shows up again once e is reclaimed */
+	b = __lookup_nat_block(shard, ni->ino);
+	if (b) {
+		struct nat_block_entry *be = nat_block_entry(b, ni->ino);
+
+		write_seqlock(&shard->seqlock);
+		if (fsync_done && ni->nid == ni->ino)
+			be->flag |= 0x01 << HAS_FSYNCED_INODE;
+		if (fsync_done)
+			be->flag |= 0x01 << HAS_LAST_FSYNC;
+		else
+			be->flag &= ~(0x01 << HAS_LAST_FSYNC);
+		write_sequnlock(&shard->seqlock);
+	}
+	up_write(&shard->lock);
 }
 
-int try_to_free_nats(struct f2fs_sb_info *sbi, int nr_shrink)
+static int __free_nats_in_shard(struct nat_cache_shard *shard, int nr_shrink)
 {
-	struct f2fs_nm_info *nm_i = NM_I(sbi);
+	unsigned int nr_blocks;
 	int nr = nr_shrink;
 
-	if (!down_write_trylock(&nm_i->nat_tree_lock))
+	if (!down_write_trylock(&shard->lock))
 		return 0;
 
-	while (nr_shrink && !list_empty(&nm_i->nat_entries)) {
+	while (nr_shrink && !list_empty(&shard->nat_entries)) {
 		struct nat_entry *ne;
-		ne = list_first_entry(&nm_i->nat_entries,
+		ne = list_first_entry(&shard->nat_entries,
 					struct nat_entry, list);
-		__del_from_nat_cache(nm_i, ne);
+		__del_from_nat_cache(shard, ne);
 		nr_shrink--;
 	}
-	up_write(&nm_i->nat_tree_lock);
+
+	/* then whole NAT blocks, giving recently hit ones a second chance */
+	nr_blocks = shard->nat_block_cnt;
+	while (nr_shrink > 0 && nr_blocks--) {
+		struct nat_block_cache *b;
+
+		b = list_first_entry(&shard->nat_blocks,
+					struct nat_block_cache, list);
+		if (b->referenced) {
+			b->referenced = 0;
+			list_move_tail(&b->list, &shard->nat_blocks);
+			continue;
+		}
+		__del_nat_block(shard, b);
+		nr_shrink -= min_t(int, nr_shrink, NAT_ENTRY_PER_BLOCK);
+	}
+	up_write(&shard->lock);
 	return nr - nr_shrink;
 }
 
+int try_to_free_nats(struct f2fs_sb_info *sbi, int nr_shrink)
+{
+	struct f2fs_nm_info *nm_i = NM_I(sbi);
+	unsigned int nr_shards = nm_i->nat_shard_mask + 1;
+	unsigned int i, idx;
+	int nr = 0;
+
+	/* spread the shrinking over the shards, starting where we left off */
+	for (i = 0; i < nr_shards && nr < nr_shrink; i++) {
+		int quota = DIV_ROUND_UP(nr_shrink - nr, nr_shards - i);
+
+		idx = nm_i->nat_shrink_idx++ & nm_i->nat_shard_mask;
+		nr += __free_nats_in_shard(&nm_i->nat_shards[idx], quota);
+	}
+	return nr;
+}
+
 /*
  * This function always returns success
  */
@@ -377,27 +589,22 @@ void get_node_info(struct f2fs_sb_info *sbi, nid_t nid, struct node_info *ni)
 	struct curseg_info *curseg = CURSEG_I(sbi, CURSEG_HOT_DATA);
 	struct f2fs_journal *journal = curseg->journal;
 	nid_t start_nid = START_NID(nid);
+	struct nat_block_cache *b = NULL;
 	struct f2fs_nat_block *nat_blk;
 	struct page *page = NULL;
 	struct f2fs_nat_entry ne;
-	struct nat_entry *e;
 	int i;
 
-	ni->nid = nid;
-
 	/* Check nat cache */
-	down_read(&nm_i->nat_tree_lock);
-	e = __lookup_nat_cache(nm_i, nid);
-	if (e) {
-		ni->ino = nat_get_ino(e);
-		ni->blk_addr = nat_get_blkaddr(e);
-		ni->version = nat_get_version(e);
-		up_read(&nm_i->nat_tree_lock);
+	if (lookup_nat_cache_rcu(nm_i, nid, ni))
 		return;
-	}
 
+	ni->nid = nid;
 	memset(&ne, 0, sizeof(struct f2fs_nat_entry));
 
+	/* keep flush_nat_entries() from moving it under us */
+	down_read(&nm_i->nat_tree_lock);
+
 	/* Check current segment summary */
 	down_read(&curseg->journal_rwsem);
 	i = lookup_journal_in_cursum(journal, NAT_JOURNAL, nid, 0);
@@ -414,13 +621,21 @@ void get_node_info(struct f2fs_sb_info *sbi, nid_t nid, struct node_info *ni)
 	nat_blk = (struct f2fs_nat_block *)page_address(page);
 	ne = nat_blk->entries[nid - start_nid];
 	node_info_from_raw_nat(ni, &ne);
+
+	/*
+	 * we have read the whole block, so keep all of it; it is inserted
+	 * before nat_tree_lock is dropped, or a flush could outdate it
+	 */
+	if (available_free_memory(sbi, NAT_ENTRIES))
+		b = build_nat_block(sbi, nat_blk, start_nid);
 	f2fs_put_page(page, 1);
+	if (b)
+		cache_nat_block(sbi, b);
 cache:
 	up_read(&nm_i->nat_tree_lock);
 	/* cache nat entry */
-	down_write(&nm_i->nat_tree_lock);
-	cache_nat_entry(sbi, nid, &ne);
-	up_write(&nm_i->nat_tree_lock);
+	if (!b)
+		cache_nat_entry(sbi, ni);
 }
 
 /*
@@ -555,6 +770,111 @@ got:
 	return level;
 }
 
+static void fill_node_cursor(struct inode *inode, struct page *parent,
+						int level, int offset[4])
+{
+	struct f2fs_inode_info *fi = F2FS_I(inode);
+	struct node_cursor *nc = &fi->node_cursor;
+	unsigned int start = offset[level - 1];
+	unsigned int i, cnt;
+
+	cnt = min_t(unsigned int, NODE_CURSOR_NIDS, NIDS_PER_BLOCK - start);
+
+	spin_lock(&fi->node_cursor_lock);
+	nc->level = level;
+	nc->path[0] = offset[0];
+	nc->path[1] = level > 2 ? offset[1] : 0;
+	nc->start = start;
+	for (i = 0; i < NODE_CURSOR_NIDS; i++)
+		nc->nids[i] = i < cnt ? get_nid(parent, start + i, false) : 0;
+	spin_unlock(&fi->node_cursor_lock);
+}
+
+static void reset_node_cursor(struct inode *inode)
+{
+	struct f2fs_inode_info *fi = F2FS_I(inode);
+
+	spin_lock(&fi->node_cursor_lock);
+	fi->node_cursor.level = 0;
+	spin_unlock(&fi->node_cursor_lock);
+}
+
+/*
+ * Return the cached nid of the direct node, and copy it along with the
+ * cached nids of its siblings into ra_nids for readahead.
+ */
+static nid_t lookup_node_cursor(struct inode *inode, int level, int offset[4],
+						nid_t ra_nids[NODE_CURSOR_NIDS])
+{
+	struct f2fs_inode_info *fi = F2FS_I(inode);
+	struct node_cursor *nc = &fi->node_cursor;
+	unsigned int i, idx;
+	nid_t nid = 0;
+
+	memset(ra_nids, 0, sizeof(nid_t) * NODE_CURSOR_NIDS);
+
+	spin_lock(&fi->node_cursor_lock);
+	idx = offset[level - 1] - nc->start;
+	if (nc->level == level && nc->path[0] == offset[0] &&
+			(level < 3 || nc->path[1] == offset[1]) &&
+			idx < NODE_CURSOR_NIDS) {
+		nid = nc->nids[idx];
+		for (i = idx; i < NODE_CURSOR_NIDS; i++)
+			ra_nids[i - idx] = nc->nids[i];
+	}
+	spin_unlock(&fi->node_cursor_lock);
+	return nid;
+}
+
+/* same as ra_node_pages(), but for the siblings kept by the cursor */
+static void ra_node_cursor(struct f2fs_sb_info *sbi,
+					nid_t ra_nids[NODE_CURSOR_NIDS])
+{
+	struct blk_plug plug;
+	int i;
+
+	blk_start_plug(&plug);
+	for (i = 0; i < NODE_CURSOR_NIDS && ra_nids[i]; i++)
+		ra_node_page(sbi, ra_nids[i]);
+	blk_finish_plug(&plug);
+}
+
+/*
+ * Get the direct node from the cursor instead of walking through its
+ * indirect nodes. The locked inode page is unlocked for the lookup and
+ * locked again if the cursor misses.
+ */
+static struct page *get_node_page_cursor(struct dnode_of_data *dn, int mode,
+			int level, int offset[4], unsigned int noffset[4])
+{
+	struct f2fs_sb_info *sbi = F2FS_I_SB(dn->inode);
+	nid_t ra_nids[NODE_CURSOR_NIDS];
+	struct page *page;
+	nid_t nid;
+
+	nid = lookup_node_cursor(dn->inode, level, offset, ra_nids);
+	if (!nid)
+		return NULL;
+
+	unlock_page(dn->inode_page);
+	if (mode == LOOKUP_NODE_RA)
+		ra_node_cursor(sbi, ra_nids);
+	page = get_node_page(sbi, nid);
+	if (!IS_ERR(page)) {
+		if (ino_of_node(page) == dn->inode->i_ino &&
+				ofs_of_node(page) == noffset[level]) {
+			dn->inode_page_locked = false;
+			return page;
+		}
+		f2fs_put_page(page, 1);
+	}
+
+	/* the node was truncated behind us, walk from the inode */
+	reset_node_cursor(dn->inode);
+	lock_page(dn->inode_page);
+	return NULL;
+}
+
 /*
  * Caller should call f2fs_put_dnode(dn).
  * Also, it should grab and release a rwsem by calling f2fs_lock_op() and
@@ -591,11 +911,20 @@ int get_dnode_of_data(struct dnode_of_data *dn, pgoff_t index, int mode)
 	}
 
 	parent = npage[0];
-	if (level != 0)
-		nids[1] = get_nid(parent, offset[0], true);
 	dn->inode_page = npage[0];
 	dn->inode_page_locked = true;
 
+	if (level > 1) {
+		npage[level] = get_node_page_cursor(dn, mode, level,
+							offset, noffset);
+		if (npage[level]) {
+			nids[level] = nid_of_node(npage[level]);
+			goto got_dnode;
+		}
+	}
+	if (level != 0)
+		nids[1] = get_nid(parent, offset[0], true);
+
 	/* get indirect or direct nodes */
 	for (i = 1; i <= level; i++) {
 		bool done = false;
@@ -644,8 +973,12 @@ int get_dnode_of_data(struct dnode_of_data *dn, pgoff_t index, int mode)
 		if (i < level) {
 			parent = npage[i];
 			nids[i + 1] = get_nid(parent, offset[i], false);
+			if (i == level - 1)
+				fill_node_cursor(dn->inode, parent,
+							level, offset);
 		}
 	}
+got_dnode:
 	dn->nid = nids[level];
 	dn->ofs_in_node = offset[level];
 	dn->node_page = npage[level];
@@ -673,6 +1006,7 @@ static void truncate_node(struct dnode_of_data *dn)
 	struct node_info ni;
 
 	get_node_info(sbi, dn->nid, &ni);
+	reset_node_cursor(dn->inode);
 	if (dn->inode->i_blocks == 0) {
 		f2fs_bug_on(sbi, ni.blk_addr != NULL_ADDR);
 		goto invalidate;
@@ -690,6 +1024,7 @@ static void truncate_node(struct dnode_of_data *dn)
 		f2fs_inode_synced(dn->inode);
 	}
 invalidate:
+	clear_gc_node(dn->node_page);
 	clear_node_page_dirty(dn->node_page);
 	set_sbi_flag(sbi, SBI_IS_DIRTY);
 
@@ -1239,6 +1574,7 @@ void move_node_page(struct page *node_page, int gc_type)
 
 		set_page_dirty(node_page);
 		f2fs_wait_on_page_writeback(node_page, NODE, true);
+		set_gc_node(node_page);
 
 		f2fs_bug_on(sbi, PageWriteback(node_page));
 		if (!clear_page_dirty_for_io(node_page))
@@ -1249,8 +1585,10 @@ void move_node_page(struct page *node_page, int gc_type)
 		goto release_page;
 	} else {
 		/* set page dirty and write it */
-		if (!PageWriteback(node_page))
+		if (!PageWriteback(node_page)) {
+			set_gc_node(node_page);
 			set_page_dirty(node_page);
+		}
 	}
 out_page:
 	unlock_page(node_page);
@@ -1318,19 +1656,33 @@ continue_unlock:
 	return last_page;
 }
 
-int fsync_node_pages(struct f2fs_sb_info *sbi, struct inode *inode,
-			struct writeback_control *wbc, bool atomic)
+static struct inode *__lookup_fsync_inode(struct inode **inodes, int nr,
+								nid_t ino)
+{
+	int i;
+
+	for (i = 0; i < nr; i++)
+		if (inodes[i]->i_ino == ino)
+			return inodes[i];
+	return NULL;
+}
+
+/*
+ * Write the dnodes of @nr inodes in a single pass over the dirty node
+ * pages. @atomic is only valid for a single inode.
+ */
+static int __fsync_node_pages(struct f2fs_sb_info *sbi, struct inode **inodes,
+		int nr, struct writeback_control *wbc, bool atomic)
 {
 	pgoff_t index, end;
 	struct pagevec pvec;
 	int ret = 0;
 	struct page *last_page = NULL;
 	bool marked = false;
-	nid_t ino = inode->i_ino;
 	int nwritten = 0;
 
 	if (atomic) {
-		last_page = last_fsync_dnode(sbi, ino);
+		last_page = last_fsync_dnode(sbi, inodes[0]->i_ino);
 		if (IS_ERR_OR_NULL(last_page))
 			return PTR_ERR_OR_ZERO(last_page);
 	}
@@ -1349,6 +1701,7 @@ retry:
 
 		for (i = 0; i < nr_pages; i++) {
 			struct page *page = pvec.pages[i];
+			struct inode *inode;
 
 			if (unlikely(f2fs_cp_error(sbi))) {
 				f2fs_put_page(last_page, 0);
@@ -1359,7 +1712,9 @@ retry:
 
 			if (!IS_DNODE(page) || !is_cold_node(page))
 				continue;
-			if (ino_of_node(page) != ino)
+			inode = __lookup_fsync_inode(inodes, nr,
+							ino_of_node(page));
+			if (!inode)
 				continue;
 
 			lock_page(page);
@@ -1369,7 +1724,7 @@ continue_unlock:
 				unlock_page(page);
 				continue;
 			}
-			if (ino_of_node(page) != ino)
+			if (ino_of_node(page) != inode->i_ino)
 				goto continue_unlock;
 
 			if (!PageDirty(page) && page != last_page) {
@@ -1387,7 +1742,8 @@ continue_unlock:
 								FI_DIRTY_INODE))
 						update_inode(inode, page);
 					set_dentry_mark(page,
-						need_dentry_mark(sbi, ino));
+						need_dentry_mark(sbi,
+							inode->i_ino));
 				}
 				/*  may be written by other thread */
 				if (!PageDirty(page))
@@ -1421,7 +1777,7 @@ continue_unlock:
 	if (!ret && atomic && !marked) {
 		f2fs_msg(sbi->sb, KERN_DEBUG,
 			"Retry to write fsync mark: ino=%u, idx=%lx",
-					ino, last_page->index);
+					inodes[0]->i_ino, last_page->index);
 		lock_page(last_page);
 		f2fs_wait_on_page_writeback(last_page, NODE, true);
 		set_page_dirty(last_page);
@@ -1429,11 +1785,31 @@ continue_unlock:
 		goto retry;
 	}
 out:
-	if (nwritten)
-		f2fs_submit_merged_bio_cond(sbi, NULL, NULL, ino, NODE, WRITE);
+	if (nwritten && nr == 1)
+		f2fs_submit_merged_bio_cond(sbi, NULL, NULL, inodes[0]->i_ino,
+								NODE, WRITE);
+	else if (nwritten)
+		f2fs_submit_merged_bio(sbi, NODE, WRITE);
 	return ret ? -EIO: 0;
 }
 
+int fsync_node_pages(struct f2fs_sb_info *sbi, struct inode *inode,
+			struct writeback_control *wbc, bool atomic)
+{
+	return __fsync_node_pages(sbi, &inode, 1, wbc, atomic);
+}
+
+/*
+ * Same as fsync_node_pages() without atomic writes, but for a group of
+ * inodes at once: their dnodes are written in a single pass over the dirty
+ * node pages and submitted as one merged bio stream.
+ */
+int fsync_node_pages_group(struct f2fs_sb_info *sbi, struct inode **inodes,
+				int nr, struct writeback_control *wbc)
+{
+	return __fsync_node_pages(sbi, inodes, nr, wbc, false);
+}
+
 int sync_node_pages(struct f2fs_sb_info *sbi, struct writeback_control *wbc)
 {
 	pgoff_t index, end;
@@ -1614,6 +1990,7 @@ static int f2fs_write_node_page(struct page *page,
 
 	/* This page is already truncated */
 	if (unlikely(ni.blk_addr == NULL_ADDR)) {
+		clear_gc_node(page);
 		ClearPageUptodate(page);
 		dec_page_count(sbi, F2FS_DIRTY_NODES);
 		up_read(&sbi->node_write);
@@ -1624,6 +2001,7 @@ static int f2fs_write_node_page(struct page *page,
 	set_page_writeback(page);
 	fio.old_blkaddr = ni.blk_addr;
 	write_node_page(nid, &fio);
+	clear_gc_node(page);
 	set_node_addr(sbi, &ni, fio.new_blkaddr, is_fsync_dnode(page));
 	dec_page_count(sbi, F2FS_DIRTY_NODES);
 	up_read(&sbi->node_write);
@@ -1752,8 +2130,8 @@ static int add_free_nid(struct f2fs_sb_info *sbi, nid_t nid, bool build)
 		return 0;
 
 	if (build) {
-		/* do not add allocated nids */
-		ne = __lookup_nat_cache(nm_i, nid);
+		/* do not add allocated nids, caller holds the shard lock */
+		ne = __lookup_nat_cache(NAT_SHARD(nm_i, nid), nid);
 		if (ne && (!get_nat_flag(ne, IS_CHECKPOINTED) ||
 				nat_get_blkaddr(ne) != NULL_ADDR))
 			return 0;
@@ -1797,14 +2175,75 @@ static void remove_free_nid(struct f2fs_sb_info *sbi, nid_t nid)
 		kmem_cache_free(free_nid_slab, i);
 }
 
+static char *__free_nid_bits(struct f2fs_nm_info *nm_i, unsigned int nat_ofs)
+{
+	return nm_i->free_nid_bitmap + nat_ofs * NAT_ENTRY_BITMAP_SIZE;
+}
+
+/*
+ * A set bit means the nid is free on disk and has not been handed out by
+ * alloc_nid(). Bits are only kept for NAT blocks which have been loaded.
+ * Caller should hold nid_list_lock.
+ */
+static void __update_free_nid_bitmap(struct f2fs_nm_info *nm_i, nid_t nid,
+								bool free)
+{
+	unsigned int nat_ofs = NAT_BLOCK_OFFSET(nid);
+	unsigned int nid_ofs = nid - START_NID(nid);
+	char *bits;
+
+	if (!test_bit(nat_ofs, nm_i->nat_block_bitmap))
+		return;
+
+	bits = __free_nid_bits(nm_i, nat_ofs);
+	if (free == !!f2fs_test_bit(nid_ofs, bits))
+		return;
+
+	if (free) {
+		f2fs_set_bit(nid_ofs, bits);
+		nm_i->free_nid_count[nat_ofs]++;
+	} else {
+		f2fs_clear_bit(nid_ofs, bits);
+		nm_i->free_nid_count[nat_ofs]--;
+	}
+}
+
+static void load_free_nid_bits(struct f2fs_nm_info *nm_i,
+		struct f2fs_nat_block *nat_blk, unsigned int nat_ofs)
+{
+	char *bits = __free_nid_bits(nm_i, nat_ofs);
+	nid_t nid = nat_ofs * NAT_ENTRY_PER_BLOCK;
+	unsigned short cnt = 0;
+	int i;
+
+	memset(bits, 0, NAT_ENTRY_BITMAP_SIZE);
+	for (i = 0; i < NAT_ENTRY_PER_BLOCK; i++, nid++) {
+		if (unlikely(nid >= nm_i->max_nid))
+			break;
+		if (nid == 0 ||
+			le32_to_cpu(nat_blk->entries[i].block_addr) != NULL_ADDR)
+			continue;
+		f2fs_set_bit(i, bits);
+		cnt++;
+	}
+	nm_i->free_nid_count[nat_ofs] = cnt;
+	set_bit(nat_ofs, nm_i->nat_block_bitmap);
+}
+
 static void scan_nat_page(struct f2fs_sb_info *sbi,
 			struct page *nat_page, nid_t start_nid)
 {
 	struct f2fs_nm_info *nm_i = NM_I(sbi);
 	struct f2fs_nat_block *nat_blk = page_address(nat_page);
+	unsigned int nat_ofs = NAT_BLOCK_OFFSET(start_nid);
 	block_t blk_addr;
 	int i;
 
+	spin_lock(&nm_i->nid_list_lock);
+	if (!test_bit(nat_ofs, nm_i->nat_block_bitmap))
+		load_free_nid_bits(nm_i, nat_blk, nat_ofs);
+	spin_unlock(&nm_i->nid_list_lock);
+
 	i = start_nid % NAT_ENTRY_PER_BLOCK;
 
 	for (; i < NAT_ENTRY_PER_BLOCK; i++, start_nid++) {
@@ -1819,70 +2258,293 @@ static void scan_nat_page(struct f2fs_sb_info *sbi,
 	}
 }
 
-static void __build_free_nids(struct f2fs_sb_info *sbi, bool sync)
+/*
+ * Collect free nids from the loaded NAT blocks which have the most free bits,
+ * without reading any NAT page. The counts are only a hint here, since
+ * add_free_nid() checks every nid against the nat cache.
+ */
+static int scan_free_nid_bits(struct f2fs_sb_info *sbi)
+{
+	struct f2fs_nm_info *nm_i = NM_I(sbi);
+	unsigned int blocks[FREE_NID_PAGES];
+	unsigned int nr = 0, nat_ofs, i;
+	int found = 0;
+
+	for_each_set_bit(nat_ofs, nm_i->nat_block_bitmap, nm_i->nat_blocks) {
+		unsigned short cnt = READ_ONCE(nm_i->free_nid_count[nat_ofs]);
+
+		if (!cnt)
+			continue;
+		if (nr == FREE_NID_PAGES &&
+				nm_i->free_nid_count[blocks[nr - 1]] >= cnt)
+			continue;
+
+		/* keep blocks[] sorted, densest first */
+		if (nr < FREE_NID_PAGES)
+			nr++;
+		for (i = nr - 1; i > 0 &&
+			nm_i->free_nid_count[blocks[i - 1]] < cnt; i--)
+			blocks[i] = blocks[i - 1];
+		blocks[i] = nat_ofs;
+	}
+
+	for (i = 0; i < nr; i++) {
+		nid_t start_nid = blocks[i] * NAT_ENTRY_PER_BLOCK;
+		struct nat_cache_shard *shard = NAT_SHARD(nm_i, start_nid);
+		char *bits = __free_nid_bits(nm_i, blocks[i]);
+		int ofs;
+
+		down_read(&shard->lock);
+		for (ofs = 0; ofs < NAT_ENTRY_PER_BLOCK; ofs++) {
+			if (f2fs_test_bit(ofs, bits))
+				found += add_free_nid(sbi, start_nid + ofs,
+									true);
+		}
+		up_read(&shard->lock);
+
+		if (nm_i->nid_cnt[FREE_NID_LIST] >= MAX_FREE_NIDS)
+			break;
+	}
+	return found;
+}
+
+static void __build_free_nids(struct f2fs_sb_info *sbi, bool sync,
+							unsigned int target)
 {
 	struct f2fs_nm_info *nm_i = NM_I(sbi);
 	struct curseg_info *curseg = CURSEG_I(sbi, CURSEG_HOT_DATA);
 	struct f2fs_journal *journal = curseg->journal;
+	unsigned int scanned = 0;
+	bool read_pages = false;
 	int i = 0;
 	nid_t nid = nm_i->next_scan_nid;
 
 	/* Enough entries */
-	if (nm_i->nid_cnt[FREE_NID_LIST] >= NAT_ENTRY_PER_BLOCK)
+	if (nm_i->nid_cnt[FREE_NID_LIST] >= target)
 		return;
 
 	if (!sync && !available_free_memory(sbi, FREE_NIDS))
 		return;
 
+	down_read(&nm_i->nat_tree_lock);
+
+	if (scan_free_nid_bits(sbi))
+		goto scan_journal;
+
 	/* readahead nat pages to be scanned */
 	ra_meta_pages(sbi, NAT_BLOCK_OFFSET(nid), FREE_NID_PAGES,
 							META_NAT, true);
+	read_pages = true;
 
-	down_read(&nm_i->nat_tree_lock);
-
+	/* only read NAT blocks whose free nids are not in the bitmap yet */
 	while (1) {
-		struct page *page = get_current_nat_page(sbi, nid);
+		struct nat_cache_shard *shard = NAT_SHARD(nm_i, nid);
+		struct page *page;
 
-		scan_nat_page(sbi, page, nid);
-		f2fs_put_page(page, 1);
+		if (!test_bit(NAT_BLOCK_OFFSET(nid), nm_i->nat_block_bitmap)) {
+			page = get_current_nat_page(sbi, nid);
+
+			down_read(&shard->lock);
+			scan_nat_page(sbi, page, nid);
+			up_read(&shard->lock);
+			f2fs_put_page(page, 1);
+			i++;
+		}
 
 		nid += (NAT_ENTRY_PER_BLOCK - (nid % NAT_ENTRY_PER_BLOCK));
 		if (unlikely(nid >= nm_i->max_nid))
 			nid = 0;
 
-		if (++i >= FREE_NID_PAGES)
+		if (i >= FREE_NID_PAGES || ++scanned >= nm_i->nat_blocks)
 			break;
 	}
 
 	/* go to the next free nat pages to find free nids abundantly */
 	nm_i->next_scan_nid = nid;
 
+scan_journal:
+
 	/* find free nids from current sum_pages */
 	down_read(&curseg->journal_rwsem);
 	for (i = 0; i < nats_in_cursum(journal); i++) {
+		struct nat_cache_shard *shard;
 		block_t addr;
 
 		addr = le32_to_cpu(nat_in_journal(journal, i).block_addr);
 		nid = le32_to_cpu(nid_in_journal(journal, i));
-		if (addr == NULL_ADDR)
+
+		/* the journal overrides what NAT pages say */
+		spin_lock(&nm_i->nid_list_lock);
+		__update_free_nid_bitmap(nm_i, nid, addr == NULL_ADDR);
+		spin_unlock(&nm_i->nid_list_lock);
+
+		if (addr == NULL_ADDR) {
+			shard = NAT_SHARD(nm_i, nid);
+			down_read(&shard->lock);
 			add_free_nid(sbi, nid, true);
-		else
+			up_read(&shard->lock);
+		} else {
 			remove_free_nid(sbi, nid);
+		}
 	}
 	up_read(&curseg->journal_rwsem);
 	up_read(&nm_i->nat_tree_lock);
 
-	ra_meta_pages(sbi, NAT_BLOCK_OFFSET(nm_i->next_scan_nid),
+	if (read_pages)
+		ra_meta_pages(sbi, NAT_BLOCK_OFFSET(nm_i->next_scan_nid),
 					nm_i->ra_nid_pages, META_NAT, false);
 }
 
 void build_free_nids(struct f2fs_sb_info *sbi, bool sync)
 {
 	mutex_lock(&NM_I(sbi)->build_lock);
-	__build_free_nids(sbi, sync);
+	__build_free_nids(sbi, sync, NAT_ENTRY_PER_BLOCK);
 	mutex_unlock(&NM_I(sbi)->build_lock);
 }
 
+void wake_up_nid_refill(struct f2fs_sb_info *sbi)
+{
+	struct f2fs_nm_info *nm_i = NM_I(sbi);
+
+	if (!nm_i->nid_refill_task ||
+			nm_i->nid_cnt[FREE_NID_LIST] >= nm_i->nid_low_wmark)
+		return;
+
+	nm_i->nid_refill_wake = 1;
+	wake_up_interruptible(&nm_i->nid_refill_wq);
+}
+
+/*
+ * Read the next NAT blocks to be scanned into the page cache, so that
+ * __build_free_nids() won't wait for I/O while holding build_lock.
+ */
+static void prefetch_nat_pages(struct f2fs_sb_info *sbi)
+{
+	struct f2fs_nm_info *nm_i = NM_I(sbi);
+	nid_t nid = READ_ONCE(nm_i->next_scan_nid);
+	int i;
+
+	ra_meta_pages(sbi, NAT_BLOCK_OFFSET(nid), FREE_NID_PAGES,
+							META_NAT, true);
+
+	down_read(&nm_i->nat_tree_lock);
+	for (i = 0; i < FREE_NID_PAGES; i++) {
+		if (!test_bit(NAT_BLOCK_OFFSET(nid), nm_i->nat_block_bitmap))
+			f2fs_put_page(get_current_nat_page(sbi, nid), 1);
+
+		nid += (NAT_ENTRY_PER_BLOCK - (nid % NAT_ENTRY_PER_BLOCK));
+		if (unlikely(nid >= nm_i->max_nid))
+			nid = 0;
+	}
+	up_read(&nm_i->nat_tree_lock);
+}
+
+static void refill_free_nids(struct f2fs_sb_info *sbi)
+{
+	struct f2fs_nm_info *nm_i = NM_I(sbi);
+	unsigned int high = max(nm_i->nid_high_wmark, nm_i->nid_low_wmark);
+	unsigned int cnt;
+
+	while (!kthread_should_stop()) {
+		cnt = nm_i->nid_cnt[FREE_NID_LIST];
+		if (cnt >= high || !available_free_memory(sbi, FREE_NIDS))
+			break;
+
+		prefetch_nat_pages(sbi);
+
+		mutex_lock(&nm_i->build_lock);
+		__build_free_nids(sbi, false, high);
+		mutex_unlock(&nm_i->build_lock);
+
+		/* nothing more to find until nids are freed by checkpoint */
+		if (nm_i->nid_cnt[FREE_NID_LIST] <= cnt)
+			break;
+	}
+}
+
+static int nid_refill_thread(void *data)
+{
+	struct f2fs_sb_info *sbi = data;
+	struct f2fs_nm_info *nm_i = NM_I(sbi);
+	wait_queue_head_t *q = &nm_i->nid_refill_wq;
+
+	set_freezable();
+	do {
+		wait_event_interruptible(*q,
+				kthread_should_stop() || nm_i->nid_refill_wake);
+		if (try_to_freeze())
+			continue;
+		if (kthread_should_stop())
+			break;
+
+		nm_i->nid_refill_wake = 0;
+		refill_free_nids(sbi);
+	} while (!kthread_should_stop());
+	return 0;
+}
+
+/*
+ * Move a batch of free nids into @mag. Caller should hold mag->lock and
+ * nid_list_lock.
+ */
+static void __refill_nid_magazine(struct f2fs_sb_info *sbi,
+					struct free_nid_magazine *mag)
+{
+	struct f2fs_nm_info *nm_i = NM_I(sbi);
+	struct free_nid *i;
+
+	while (mag->nr < NID_MAG_BATCH && nm_i->available_nids &&
+					nm_i->nid_cnt[FREE_NID_LIST]) {
+		i = list_first_entry(&nm_i->nid_list[FREE_NID_LIST],
+					struct free_nid, list);
+		__remove_nid_from_list(sbi, i, FREE_NID_LIST, true);
+		i->state = NID_ALLOC;
+		__insert_nid_to_list(sbi, i, ALLOC_NID_LIST, false);
+		__update_free_nid_bitmap(nm_i, i->nid, false);
+		nm_i->available_nids--;
+		mag->nids[mag->nr++] = i;
+	}
+}
+
+/*
+ * Give reserved nids in @mag back to the free nid list. Caller should hold
+ * mag->lock and nid_list_lock.
+ */
+static int __drain_nid_magazine(struct f2fs_sb_info *sbi,
+					struct free_nid_magazine *mag)
+{
+	struct f2fs_nm_info *nm_i = NM_I(sbi);
+	int nr = mag->nr;
+
+	while (mag->nr) {
+		struct free_nid *i = mag->nids[--mag->nr];
+
+		__remove_nid_from_list(sbi, i, ALLOC_NID_LIST, true);
+		i->state = NID_NEW;
+		__insert_nid_to_list(sbi, i, FREE_NID_LIST, false);
+		__update_free_nid_bitmap(nm_i, i->nid, true);
+		nm_i->available_nids++;
+	}
+	return nr;
+}
+
+static int drain_nid_magazines(struct f2fs_sb_info *sbi)
+{
+	struct f2fs_nm_info *nm_i = NM_I(sbi);
+	int cpu, nr = 0;
+
+	for_each_possible_cpu(cpu) {
+		struct free_nid_magazine *mag = per_cpu_ptr(nm_i->nid_mags, cpu);
+
+		spin_lock(&mag->lock);
+		spin_lock(&nm_i->nid_list_lock);
+		nr += __drain_nid_magazine(sbi, mag);
+		spin_unlock(&nm_i->nid_list_lock);
+		spin_unlock(&mag->lock);
+	}
+	return nr;
+}
+
 /*
  * If this function returns success, caller can obtain a new nid
  * from second parameter of this function.
@@ -1891,38 +2553,51 @@ void build_free_nids(struct f2fs_sb_info *sbi, bool sync)
 bool alloc_nid(struct f2fs_sb_info *sbi, nid_t *nid)
 {
 	struct f2fs_nm_info *nm_i = NM_I(sbi);
-	struct free_nid *i = NULL;
+	struct free_nid_magazine *mag;
 retry:
 #ifdef CONFIG_F2FS_FAULT_INJECTION
 	if (time_to_inject(sbi, FAULT_ALLOC_NID))
 		return false;
 #endif
+	mag = get_cpu_ptr(nm_i->nid_mags);
+	spin_lock(&mag->lock);
+	if (mag->nr)
+		goto got_it;
+
 	spin_lock(&nm_i->nid_list_lock);
 
 	if (unlikely(nm_i->available_nids == 0)) {
 		spin_unlock(&nm_i->nid_list_lock);
+		spin_unlock(&mag->lock);
+		put_cpu_ptr(nm_i->nid_mags);
+
+		/* the last nids may be reserved by other cpus */
+		if (drain_nid_magazines(sbi))
+			goto retry;
 		return false;
 	}
 
 	/* We should not use stale free nids created by build_free_nids */
 	if (nm_i->nid_cnt[FREE_NID_LIST] && !on_build_free_nids(nm_i)) {
 		f2fs_bug_on(sbi, list_empty(&nm_i->nid_list[FREE_NID_LIST]));
-		i = list_first_entry(&nm_i->nid_list[FREE_NID_LIST],
-					struct free_nid, list);
-		*nid = i->nid;
-
-		__remove_nid_from_list(sbi, i, FREE_NID_LIST, true);
-		i->state = NID_ALLOC;
-		__insert_nid_to_list(sbi, i, ALLOC_NID_LIST, false);
-		nm_i->available_nids--;
+		__refill_nid_magazine(sbi, mag);
 		spin_unlock(&nm_i->nid_list_lock);
-		return true;
+		wake_up_nid_refill(sbi);
+		goto got_it;
 	}
+	nm_i->sync_nid_builds++;
 	spin_unlock(&nm_i->nid_list_lock);
+	spin_unlock(&mag->lock);
+	put_cpu_ptr(nm_i->nid_mags);
 
 	/* Let's scan nat pages and its caches to get free nids */
 	build_free_nids(sbi, true);
 	goto retry;
+got_it:
+	*nid = mag->nids[--mag->nr]->nid;
+	spin_unlock(&mag->lock);
+	put_cpu_ptr(nm_i->nid_mags);
+	return true;
 }
 
 /*
@@ -1948,16 +2623,32 @@ void alloc_nid_done(struct f2fs_sb_info *sbi, nid_t nid)
 void alloc_nid_failed(struct f2fs_sb_info *sbi, nid_t nid)
 {
 	struct f2fs_nm_info *nm_i = NM_I(sbi);
+	struct free_nid_magazine *mag;
 	struct free_nid *i;
 	bool need_free = false;
 
 	if (!nid)
 		return;
 
-	spin_lock(&nm_i->nid_list_lock);
+	/* we own the nid, so it can't go away under the rcu lookup */
+	rcu_read_lock();
 	i = __lookup_free_nid_list(nm_i, nid);
+	rcu_read_unlock();
 	f2fs_bug_on(sbi, !i);
 
+	/* keep it reserved for the next alloc_nid() on this cpu */
+	mag = get_cpu_ptr(nm_i->nid_mags);
+	spin_lock(&mag->lock);
+	if (mag->nr < NID_MAG_SIZE) {
+		mag->nids[mag->nr++] = i;
+		spin_unlock(&mag->lock);
+		put_cpu_ptr(nm_i->nid_mags);
+		return;
+	}
+	spin_unlock(&mag->lock);
+	put_cpu_ptr(nm_i->nid_mags);
+
+	spin_lock(&nm_i->nid_list_lock);
 	if (!available_free_memory(sbi, FREE_NIDS)) {
 		__remove_nid_from_list(sbi, i, ALLOC_NID_LIST, false);
 		need_free = true;
@@ -1967,6 +2658,7 @@ void alloc_nid_failed(struct f2fs_sb_info *sbi, nid_t nid)
 		__insert_nid_to_list(sbi, i, FREE_NID_LIST, false);
 	}
 
+	__update_free_nid_bitmap(nm_i, nid, true);
 	nm_i->available_nids++;
 
 	spin_unlock(&nm_i->nid_list_lock);
@@ -2157,16 +2849,22 @@ static void remove_nats_in_journal(struct f2fs_sb_info *sbi)
 
 	down_write(&curseg->journal_rwsem);
 	for (i = 0; i < nats_in_cursum(journal); i++) {
+		struct nat_cache_shard *shard;
 		struct nat_entry *ne;
 		struct f2fs_nat_entry raw_ne;
 		nid_t nid = le32_to_cpu(nid_in_journal(journal, i));
 
 		raw_ne = nat_in_journal(journal, i);
 
-		ne = __lookup_nat_cache(nm_i, nid);
+		shard = NAT_SHARD(nm_i, nid);
+		down_write(&shard->lock);
+		ne = __lookup_nat_cache(shard, nid);
 		if (!ne) {
-			ne = grab_nat_entry(nm_i, nid, true);
-			node_info_from_raw_nat(&ne->ni, &raw_ne);
+			struct node_info ni;
+
+			ni.nid = nid;
+			node_info_from_raw_nat(&ni, &raw_ne);
+			ne = grab_nat_entry(shard, &ni, true);
 		}
 
 		/*
@@ -2181,49 +2879,37 @@ static void remove_nats_in_journal(struct f2fs_sb_info *sbi)
 			spin_unlock(&nm_i->nid_list_lock);
 		}
 
-		__set_nat_cache_dirty(nm_i, ne);
+		__set_nat_cache_dirty(shard, ne);
+		up_write(&shard->lock);
 	}
 	update_nats_in_cursum(journal, -i);
 	up_write(&curseg->journal_rwsem);
 }
 
-static void __adjust_nat_entry_set(struct nat_entry_set *nes,
-						struct list_head *head, int max)
+static int __nat_set_cmp(void *priv, struct list_head *a, struct list_head *b)
 {
-	struct nat_entry_set *cur;
+	struct nat_entry_set *sa, *sb;
 
-	if (nes->entry_cnt >= max)
-		goto add_out;
+	sa = list_entry(a, struct nat_entry_set, set_list);
+	sb = list_entry(b, struct nat_entry_set, set_list);
 
-	list_for_each_entry(cur, head, set_list) {
-		if (cur->entry_cnt >= nes->entry_cnt) {
-			list_add(&nes->set_list, cur->set_list.prev);
-			return;
-		}
-	}
-add_out:
-	list_add_tail(&nes->set_list, head);
+	return journal_set_cmp(sa->heat, sa->entry_cnt,
+					sb->heat, sb->entry_cnt);
 }
 
 static void __flush_nat_entry_set(struct f2fs_sb_info *sbi,
-					struct nat_entry_set *set)
+				struct nat_entry_set *set, bool to_journal)
 {
+	struct nat_cache_shard *shard = NAT_SHARD(NM_I(sbi),
+					set->set * NAT_ENTRY_PER_BLOCK);
 	struct curseg_info *curseg = CURSEG_I(sbi, CURSEG_HOT_DATA);
 	struct f2fs_journal *journal = curseg->journal;
 	nid_t start_nid = set->set * NAT_ENTRY_PER_BLOCK;
-	bool to_journal = true;
 	struct f2fs_nat_block *nat_blk;
+	struct nat_block_cache *b;
 	struct nat_entry *ne, *cur;
 	struct page *page = NULL;
 
-	/*
-	 * there are two steps to flush nat entries:
-	 * #1, flush nat entries to journal in current hot data summary block.
-	 * #2, flush nat entries to nat page.
-	 */
-	if (!__has_cursum_space(journal, set->entry_cnt, NAT_JOURNAL))
-		to_journal = false;
-
 	if (to_journal) {
 		down_write(&curseg->journal_rwsem);
 	} else {
@@ -2232,6 +2918,10 @@ static void __flush_nat_entry_set(struct f2fs_sb_info *sbi,
 		f2fs_bug_on(sbi, !nat_blk);
 	}
 
+	/* journal_rwsem nests outside of the shard lock */
+	down_write(&shard->lock);
+	b = __lookup_nat_block(shard, start_nid);
+
 	/* flush dirty nats in nat entry set */
 	list_for_each_entry_safe(ne, cur, &set->entry_list, list) {
 		struct f2fs_nat_entry *raw_ne;
@@ -2251,25 +2941,99 @@ static void __flush_nat_entry_set(struct f2fs_sb_info *sbi,
 			raw_ne = &nat_blk->entries[nid - start_nid];
 		}
 		raw_nat_from_node_info(raw_ne, &ne->ni);
+		write_seqlock(&shard->seqlock);
 		nat_reset_flag(ne);
-		__clear_nat_cache_dirty(NM_I(sbi), ne);
-		if (nat_get_blkaddr(ne) == NULL_ADDR) {
+		if (b)
+			nat_block_set_info(b, &ne->ni);
+		write_sequnlock(&shard->seqlock);
+		__clear_nat_cache_dirty(shard, ne);
+		if (nat_get_blkaddr(ne) == NULL_ADDR)
 			add_free_nid(sbi, nid, false);
-			spin_lock(&NM_I(sbi)->nid_list_lock);
+
+		spin_lock(&NM_I(sbi)->nid_list_lock);
+		if (nat_get_blkaddr(ne) == NULL_ADDR)
 			NM_I(sbi)->available_nids++;
-			spin_unlock(&NM_I(sbi)->nid_list_lock);
-		}
+		__update_free_nid_bitmap(NM_I(sbi), nid,
+					nat_get_blkaddr(ne) == NULL_ADDR);
+		spin_unlock(&NM_I(sbi)->nid_list_lock);
+
+		/* clean entries only need their packed copy */
+		if (b)
+			__del_from_nat_cache(shard, ne);
 	}
 
+	f2fs_bug_on(sbi, set->entry_cnt);
+
+	radix_tree_delete(&shard->nat_set_root, set->set);
+	up_write(&shard->lock);
+	kmem_cache_free(nat_entry_set_slab, set);
+
 	if (to_journal)
 		up_write(&curseg->journal_rwsem);
 	else
 		f2fs_put_page(page, 1);
+}
 
-	f2fs_bug_on(sbi, set->entry_cnt);
+struct nat_flush_work {
+	struct work_struct work;
+	struct f2fs_sb_info *sbi;
+	struct list_head sets;		/* nat entry sets to flush to pages */
+};
 
-	radix_tree_delete(&NM_I(sbi)->nat_set_root, set->set);
-	kmem_cache_free(nat_entry_set_slab, set);
+static void nat_flush_work_func(struct work_struct *work)
+{
+	struct nat_flush_work *nfw = container_of(work,
+					struct nat_flush_work, work);
+	struct nat_entry_set *set, *tmp;
+
+	list_for_each_entry_safe(set, tmp, &nfw->sets, set_list)
+		__flush_nat_entry_set(nfw->sbi, set, false);
+}
+
+/*
+ * Hand the sets going to nat pages out to per-cpu works. A shard always
+ * goes to the same work, so the works don't fight over shard locks.
+ * Returns NULL when the sets should be flushed inline instead.
+ */
+static struct nat_flush_work *prepare_nat_flush_works(
+		struct f2fs_sb_info *sbi, struct list_head *sets,
+		unsigned int *nr_works)
+{
+	struct f2fs_nm_info *nm_i = NM_I(sbi);
+	struct nat_flush_work *works;
+	struct nat_entry_set *set, *tmp;
+	unsigned int nr = 0, i;
+
+	list_for_each_entry(set, sets, set_list)
+		if (++nr >= NAT_FLUSH_MIN_SETS)
+			break;
+	if (nr < NAT_FLUSH_MIN_SETS || !nm_i->nat_flush_wq)
+		return NULL;
+
+	nr = min_t(unsigned int, num_online_cpus(), nm_i->nat_shard_mask + 1);
+	if (nr < 2)
+		return NULL;
+
+	works = kcalloc(nr, sizeof(struct nat_flush_work), GFP_NOFS);
+	if (!works)
+		return NULL;
+
+	for (i = 0; i < nr; i++) {
+		INIT_WORK(&works[i].work, nat_flush_work_func);
+		works[i].sbi = sbi;
+		INIT_LIST_HEAD(&works[i].sets);
+	}
+
+	list_for_each_entry_safe(set, tmp, sets, set_list) {
+		i = (set->set & nm_i->nat_shard_mask) % nr;
+		list_move_tail(&set->set_list, &works[i].sets);
+	}
+
+	for (i = 0; i < nr; i++)
+		queue_work(nm_i->nat_flush_wq, &works[i].work);
+
+	*nr_works = nr;
+	return works;
 }
 
 /*
@@ -2282,11 +3046,15 @@ void flush_nat_entries(struct f2fs_sb_info *sbi)
 	struct f2fs_journal *journal = curseg->journal;
 	struct nat_entry_set *setvec[SETVEC_SIZE];
 	struct nat_entry_set *set, *tmp;
-	unsigned int found;
-	nid_t set_idx = 0;
+	struct f2fs_journal_stat *jstat = &sbi->jstat[NAT_JOURNAL];
+	unsigned short cp_ver = cur_cp_version(F2FS_CKPT(sbi));
+	struct nat_flush_work *works;
+	unsigned int found, i, nr_works = 0, jentries = 0;
+	nid_t set_idx;
 	LIST_HEAD(sets);
+	LIST_HEAD(journal_sets);
 
-	if (!nm_i->dirty_nat_cnt)
+	if (!dirty_nat_count(nm_i))
 		return;
 
 	down_write(&nm_i->nat_tree_lock);
@@ -2296,25 +3064,65 @@ void flush_nat_entries(struct f2fs_sb_info *sbi)
 	 * entries, remove all entries from journal and merge them
 	 * into nat entry set.
 	 */
-	if (!__has_cursum_space(journal, nm_i->dirty_nat_cnt, NAT_JOURNAL))
+	if (!__has_cursum_space(journal, dirty_nat_count(nm_i), NAT_JOURNAL))
 		remove_nats_in_journal(sbi);
 
-	while ((found = __gang_lookup_nat_set(nm_i,
+	for (i = 0; i <= nm_i->nat_shard_mask; i++) {
+		struct nat_cache_shard *shard = &nm_i->nat_shards[i];
+
+		set_idx = 0;
+		down_read(&shard->lock);
+		while ((found = __gang_lookup_nat_set(shard,
 					set_idx, SETVEC_SIZE, setvec))) {
-		unsigned idx;
-		set_idx = setvec[found - 1]->set + 1;
-		for (idx = 0; idx < found; idx++)
-			__adjust_nat_entry_set(setvec[idx], &sets,
-						MAX_NAT_JENTRIES(journal));
+			unsigned idx;
+			set_idx = setvec[found - 1]->set + 1;
+			for (idx = 0; idx < found; idx++) {
+				set = setvec[idx];
+				set->heat = update_journal_heat(
+					&nm_i->nat_heat[set->set], cp_ver);
+				list_add_tail(&set->set_list, &sets);
+			}
+		}
+		up_read(&shard->lock);
+	}
+	list_sort(NULL, &sets, __nat_set_cmp);
+
+	/*
+	 * there are two steps to flush nat entries:
+	 * #1, flush nat entries to journal in current hot data summary block.
+	 * #2, flush nat entries to nat page.
+	 * Hot sparse sets take the journal, the others go to nat pages and
+	 * those can be flushed in parallel.
+	 */
+	list_for_each_entry_safe(set, tmp, &sets, set_list) {
+		if (jentries + set->entry_cnt > MAX_NAT_JENTRIES(journal)) {
+			jstat->bentries += set->entry_cnt;
+			jstat->blocks++;
+			continue;
+		}
+		jentries += set->entry_cnt;
+		jstat->jentries += set->entry_cnt;
+		list_move_tail(&set->set_list, &journal_sets);
 	}
 
+	works = prepare_nat_flush_works(sbi, &sets, &nr_works);
+
 	/* flush dirty nats in nat entry set */
-	list_for_each_entry_safe(set, tmp, &sets, set_list)
-		__flush_nat_entry_set(sbi, set);
+	list_for_each_entry_safe(set, tmp, &journal_sets, set_list)
+		__flush_nat_entry_set(sbi, set, true);
+
+	if (works) {
+		for (i = 0; i < nr_works; i++)
+			flush_work(&works[i].work);
+		kfree(works);
+	} else {
+		list_for_each_entry_safe(set, tmp, &sets, set_list)
+			__flush_nat_entry_set(sbi, set, false);
+	}
 
 	up_write(&nm_i->nat_tree_lock);
 
-	f2fs_bug_on(sbi, nm_i->dirty_nat_cnt);
+	f2fs_bug_on(sbi, dirty_nat_count(nm_i));
 }
 
 static int init_node_manager(struct f2fs_sb_info *sbi)
@@ -2323,6 +3131,7 @@ static int init_node_manager(struct f2fs_sb_info *sbi)
 	struct f2fs_nm_info *nm_i = NM_I(sbi);
 	unsigned char *version_bitmap;
 	unsigned int nat_segs, nat_blocks;
+	unsigned int nr_shards, i;
 
 	nm_i->nat_blkaddr = le32_to_cpu(sb_raw->nat_blkaddr);
 
@@ -2331,27 +3140,53 @@ static int init_node_manager(struct f2fs_sb_info *sbi)
 	nat_blocks = nat_segs << le32_to_cpu(sb_raw->log_blocks_per_seg);
 
 	nm_i->max_nid = NAT_ENTRY_PER_BLOCK * nat_blocks;
+	nm_i->nat_blocks = nat_blocks;
+
+	nm_i->nat_heat = f2fs_kvzalloc(nat_blocks *
+			sizeof(struct f2fs_journal_heat), GFP_KERNEL);
+	if (!nm_i->nat_heat)
+		return -ENOMEM;
 
 	/* not used nids: 0, node, meta, (and root counted as valid node) */
 	nm_i->available_nids = nm_i->max_nid - sbi->total_valid_node_count -
 							F2FS_RESERVED_NODE_NUM;
 	nm_i->nid_cnt[FREE_NID_LIST] = 0;
 	nm_i->nid_cnt[ALLOC_NID_LIST] = 0;
-	nm_i->nat_cnt = 0;
 	nm_i->ram_thresh = DEF_RAM_THRESHOLD;
 	nm_i->ra_nid_pages = DEF_RA_NID_PAGES;
+	nm_i->nid_low_wmark = DEF_NID_LOW_WMARK;
+	nm_i->nid_high_wmark = DEF_NID_HIGH_WMARK;
 	nm_i->dirty_nats_ratio = DEF_DIRTY_NAT_RATIO_THRESHOLD;
 
 	INIT_RADIX_TREE(&nm_i->free_nid_root, GFP_ATOMIC);
 	INIT_LIST_HEAD(&nm_i->nid_list[FREE_NID_LIST]);
 	INIT_LIST_HEAD(&nm_i->nid_list[ALLOC_NID_LIST]);
-	INIT_RADIX_TREE(&nm_i->nat_root, GFP_NOIO);
-	INIT_RADIX_TREE(&nm_i->nat_set_root, GFP_NOIO);
-	INIT_LIST_HEAD(&nm_i->nat_entries);
 
 	mutex_init(&nm_i->build_lock);
 	spin_lock_init(&nm_i->nid_list_lock);
 	init_rwsem(&nm_i->nat_tree_lock);
+	init_waitqueue_head(&nm_i->nid_refill_wq);
+	spin_lock_init(&nm_i->nat_bitmap_lock);
+
+	nr_shards = roundup_pow_of_two(min_t(unsigned int,
+				num_possible_cpus(), MAX_NAT_SHARDS));
+	nm_i->nat_shards = kcalloc(nr_shards, sizeof(struct nat_cache_shard),
+								GFP_KERNEL);
+	if (!nm_i->nat_shards)
+		return -ENOMEM;
+	nm_i->nat_shard_mask = nr_shards - 1;
+
+	for (i = 0; i < nr_shards; i++) {
+		struct nat_cache_shard *shard = &nm_i->nat_shards[i];
+
+		INIT_RADIX_TREE(&shard->nat_root, GFP_NOIO);
+		INIT_RADIX_TREE(&shard->nat_set_root, GFP_NOIO);
+		INIT_LIST_HEAD(&shard->nat_entries);
+		INIT_RADIX_TREE(&shard->nat_block_root, GFP_NOIO);
+		INIT_LIST_HEAD(&shard->nat_blocks);
+		init_rwsem(&shard->lock);
+		seqlock_init(&shard->seqlock);
+	}
 
 	nm_i->next_scan_nid = le32_to_cpu(sbi->ckpt->next_free_nid);
 	nm_i->bitmap_size = __bitmap_size(sbi, NAT_BITMAP);
@@ -2366,20 +3201,77 @@ static int init_node_manager(struct f2fs_sb_info *sbi)
 	return 0;
 }
 
+static int init_free_nid_cache(struct f2fs_sb_info *sbi)
+{
+	struct f2fs_nm_info *nm_i = NM_I(sbi);
+	int cpu;
+
+	nm_i->nat_block_bitmap = f2fs_kvzalloc(
+			BITS_TO_LONGS(nm_i->nat_blocks) * sizeof(unsigned long),
+			GFP_KERNEL);
+	if (!nm_i->nat_block_bitmap)
+		return -ENOMEM;
+
+	nm_i->free_nid_bitmap = f2fs_kvzalloc(nm_i->nat_blocks *
+				NAT_ENTRY_BITMAP_SIZE, GFP_KERNEL);
+	if (!nm_i->free_nid_bitmap)
+		return -ENOMEM;
+
+	nm_i->free_nid_count = f2fs_kvzalloc(nm_i->nat_blocks *
+				sizeof(unsigned short), GFP_KERNEL);
+	if (!nm_i->free_nid_count)
+		return -ENOMEM;
+
+	nm_i->nid_mags = alloc_percpu(struct free_nid_magazine);
+	if (!nm_i->nid_mags)
+		return -ENOMEM;
+	for_each_possible_cpu(cpu)
+		spin_lock_init(&per_cpu_ptr(nm_i->nid_mags, cpu)->lock);
+	return 0;
+}
+
+static int start_nid_refill_thread(struct f2fs_sb_info *sbi)
+{
+	struct f2fs_nm_info *nm_i = NM_I(sbi);
+	dev_t dev = sbi->sb->s_bdev->bd_dev;
+	int err = 0;
+
+	nm_i->nid_refill_task = kthread_run(nid_refill_thread, sbi,
+				"f2fs_nid-%u:%u", MAJOR(dev), MINOR(dev));
+	if (IS_ERR(nm_i->nid_refill_task)) {
+		err = PTR_ERR(nm_i->nid_refill_task);
+		nm_i->nid_refill_task = NULL;
+	}
+	return err;
+}
+
 int build_node_manager(struct f2fs_sb_info *sbi)
 {
+	struct f2fs_nm_info *nm_i;
+	dev_t dev = sbi->sb->s_bdev->bd_dev;
 	int err;
 
 	sbi->nm_info = kzalloc(sizeof(struct f2fs_nm_info), GFP_KERNEL);
 	if (!sbi->nm_info)
 		return -ENOMEM;
+	nm_i = NM_I(sbi);
 
 	err = init_node_manager(sbi);
 	if (err)
 		return err;
 
+	err = init_free_nid_cache(sbi);
+	if (err)
+		return err;
+
+	nm_i->nat_flush_wq = alloc_workqueue("f2fs_nat_flush-%u:%u",
+					WQ_UNBOUND | WQ_MEM_RECLAIM, 0,
+					MAJOR(dev), MINOR(dev));
+	if (!nm_i->nat_flush_wq)
+		return -ENOMEM;
+
 	build_free_nids(sbi, true);
-	return 0;
+	return start_nid_refill_thread(sbi);
 }
 
 void destroy_node_manager(struct f2fs_sb_info *sbi)
@@ -2388,12 +3280,25 @@ void destroy_node_manager(struct f2fs_sb_info *sbi)
 	struct free_nid *i, *next_i;
 	struct nat_entry *natvec[NATVEC_SIZE];
 	struct nat_entry_set *setvec[SETVEC_SIZE];
-	nid_t nid = 0;
-	unsigned int found;
+	nid_t nid;
+	unsigned int found, sh;
 
 	if (!nm_i)
 		return;
 
+	if (nm_i->nid_refill_task) {
+		kthread_stop(nm_i->nid_refill_task);
+		nm_i->nid_refill_task = NULL;
+	}
+
+	if (nm_i->nat_flush_wq)
+		destroy_workqueue(nm_i->nat_flush_wq);
+
+	if (nm_i->nid_mags) {
+		drain_nid_magazines(sbi);
+		free_percpu(nm_i->nid_mags);
+	}
+
 	/* destroy free nid list */
 	spin_lock(&nm_i->nid_list_lock);
 	list_for_each_entry_safe(i, next_i, &nm_i->nid_list[FREE_NID_LIST],
@@ -2408,34 +3313,54 @@ void destroy_node_manager(struct f2fs_sb_info *sbi)
 	f2fs_bug_on(sbi, !list_empty(&nm_i->nid_list[ALLOC_NID_LIST]));
 	spin_unlock(&nm_i->nid_list_lock);
 
-	/* destroy nat cache */
-	down_write(&nm_i->nat_tree_lock);
-	while ((found = __gang_lookup_nat_cache(nm_i,
+	for (sh = 0; nm_i->nat_shards && sh <= nm_i->nat_shard_mask; sh++) {
+		struct nat_cache_shard *shard = &nm_i->nat_shards[sh];
+
+		/* destroy nat cache */
+		nid = 0;
+		down_write(&shard->lock);
+		while ((found = __gang_lookup_nat_cache(shard,
 					nid, NATVEC_SIZE, natvec))) {
-		unsigned idx;
+			unsigned idx;
 
-		nid = nat_get_nid(natvec[found - 1]) + 1;
-		for (idx = 0; idx < found; idx++)
-			__del_from_nat_cache(nm_i, natvec[idx]);
-	}
-	f2fs_bug_on(sbi, nm_i->nat_cnt);
+			nid = nat_get_nid(natvec[found - 1]) + 1;
+			for (idx = 0; idx < found; idx++)
+				__del_from_nat_cache(shard, natvec[idx]);
+		}
+		f2fs_bug_on(sbi, shard->nat_cnt);
+
+		/* destroy packed nat blocks */
+		while (!list_empty(&shard->nat_blocks))
+			__del_nat_block(shard, list_first_entry(
+					&shard->nat_blocks,
+					struct nat_block_cache, list));
 
-	/* destroy nat set cache */
-	nid = 0;
-	while ((found = __gang_lookup_nat_set(nm_i,
+		/* destroy nat set cache */
+		nid = 0;
+		while ((found = __gang_lookup_nat_set(shard,
 					nid, SETVEC_SIZE, setvec))) {
-		unsigned idx;
-
-		nid = setvec[found - 1]->set + 1;
-		for (idx = 0; idx < found; idx++) {
-			/* entry_cnt is not zero, when cp_error was occurred */
-			f2fs_bug_on(sbi, !list_empty(&setvec[idx]->entry_list));
-			radix_tree_delete(&nm_i->nat_set_root, setvec[idx]->set);
-			kmem_cache_free(nat_entry_set_slab, setvec[idx]);
+			unsigned idx;
+
+			nid = setvec[found - 1]->set + 1;
+			for (idx = 0; idx < found; idx++) {
+				struct nat_entry_set *set = setvec[idx];
+
+				/* entry_cnt is not zero, when cp_error */
+				f2fs_bug_on(sbi, !list_empty(&set->entry_list));
+				radix_tree_delete(&shard->nat_set_root,
+								set->set);
+				kmem_cache_free(nat_entry_set_slab, set);
+			}
 		}
+		up_write(&shard->lock);
 	}
-	up_write(&nm_i->nat_tree_lock);
 
+	kvfree(nm_i->nat_heat);
+	kvfree(nm_i->free_nid_count);
+	kvfree(nm_i->free_nid_bitmap);
+	kvfree(nm_i->nat_block_bitmap);
+
+	kfree(nm_i->nat_shards);
 	kfree(nm_i->nat_bitmap);
 	sbi->nm_info = NULL;
 	kfree(nm_i);
@@ -2448,10 +3373,15 @@ int __init create_node_manager_caches(void)
 	if (!nat_entry_slab)
 		goto fail;
 
+	nat_block_slab = f2fs_kmem_cache_create("nat_block",
+			sizeof(struct nat_block_cache));
+	if (!nat_block_slab)
+		goto destroy_nat_entry;
+
 	free_nid_slab = f2fs_kmem_cache_create("free_nid",
 			sizeof(struct free_nid));
 	if (!free_nid_slab)
-		goto destroy_nat_entry;
+		goto destroy_nat_block;
 
 	nat_entry_set_slab = f2fs_kmem_cache_create("nat_entry_set",
 			sizeof(struct nat_entry_set));
@@ -2461,6 +3391,8 @@ int __init create_node_manager_caches(void)
 
 destroy_free_nid:
 	kmem_cache_destroy(free_nid_slab);
+destroy_nat_block:
+	kmem_cache_destroy(nat_block_slab);
 destroy_nat_entry:
 	kmem_cache_destroy(nat_entry_slab);
 fail:
@@ -2469,7 +3401,10 @@ fail:
 
 void destroy_node_manager_caches(void)
 {
+	/* wait for nat entries still queued by call_rcu() */
+	rcu_barrier();
 	kmem_cache_destroy(nat_entry_set_slab);
 	kmem_cache_destroy(free_nid_slab);
+	kmem_cache_destroy(nat_block_slab);
 	kmem_cache_destroy(nat_entry_slab);
 }
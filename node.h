@@ -16,10 +16,18 @@
 
 /* # of pages to perform synchronous readahead before building free nids */
 #define FREE_NID_PAGES	8
+#define NAT_ENTRY_BITMAP_SIZE	((NAT_ENTRY_PER_BLOCK + 7) / 8)
 #define MAX_FREE_NIDS	(NAT_ENTRY_PER_BLOCK * FREE_NID_PAGES)
 
 #define DEF_RA_NID_PAGES	0	/* # of nid pages to be readaheaded */
 
+/* # of nat entry sets going to nat pages before flushing them in parallel */
+#define NAT_FLUSH_MIN_SETS	16
+
+/* the free nid refill thread keeps the free nid list in [low, high] */
+#define DEF_NID_LOW_WMARK	NAT_ENTRY_PER_BLOCK
+#define DEF_NID_HIGH_WMARK	(NAT_ENTRY_PER_BLOCK * 4)
+
 /* maximum readahead size for node during getting data blocks */
 #define MAX_RA_NODE		128
 
@@ -60,6 +68,27 @@ struct node_info {
 struct nat_entry {
 	struct list_head list;	/* for clean or dirty nat list */
 	struct node_info ni;	/* in-memory node information */
+	struct rcu_head rcu_head;	/* for lockless lookups */
+};
+
+/*
+ * Clean nat entries of a whole NAT block, packed in the on-disk order.
+ * This holds 455 nids in about 4.5KB, where a struct nat_entry each would
+ * take about 22KB.
+ */
+struct nat_block_entry {
+	nid_t ino;			/* inode number of the node */
+	block_t blk_addr;		/* block address of the node */
+	unsigned char version;		/* version of the node */
+	unsigned char flag;		/* for node information bits */
+} __packed;
+
+struct nat_block_cache {
+	struct list_head list;		/* for the block LRU of a shard */
+	struct rcu_head rcu_head;	/* for lockless lookups */
+	unsigned int nat_ofs;		/* NAT block offset */
+	int referenced;			/* hit since the last shrink pass */
+	struct nat_block_entry entries[NAT_ENTRY_PER_BLOCK];
 };
 
 #define nat_get_nid(nat)		(nat->ni.nid)
@@ -123,15 +152,46 @@ static inline void raw_nat_from_node_info(struct f2fs_nat_entry *raw_ne,
 	raw_ne->version = ni->version;
 }
 
+#define NAT_SHARD(nm_i, nid)	\
+	(&(nm_i)->nat_shards[NAT_BLOCK_OFFSET(nid) & (nm_i)->nat_shard_mask])
+
+/* unlocked sums, good enough for thresholds and stats */
+static inline unsigned int nat_cache_count(struct f2fs_nm_info *nm_i)
+{
+	unsigned int i, cnt = 0;
+
+	for (i = 0; i <= nm_i->nat_shard_mask; i++)
+		cnt += READ_ONCE(nm_i->nat_shards[i].nat_cnt);
+	return cnt;
+}
+
+static inline unsigned int dirty_nat_count(struct f2fs_nm_info *nm_i)
+{
+	unsigned int i, cnt = 0;
+
+	for (i = 0; i <= nm_i->nat_shard_mask; i++)
+		cnt += READ_ONCE(nm_i->nat_shards[i].dirty_nat_cnt);
+	return cnt;
+}
+
+static inline unsigned int nat_block_count(struct f2fs_nm_info *nm_i)
+{
+	unsigned int i, cnt = 0;
+
+	for (i = 0; i <= nm_i->nat_shard_mask; i++)
+		cnt += READ_ONCE(nm_i->nat_shards[i].nat_block_cnt);
+	return cnt;
+}
+
 static inline bool excess_dirty_nats(struct f2fs_sb_info *sbi)
 {
-	return NM_I(sbi)->dirty_nat_cnt >= NM_I(sbi)->max_nid *
+	return dirty_nat_count(NM_I(sbi)) >= NM_I(sbi)->max_nid *
 					NM_I(sbi)->dirty_nats_ratio / 100;
 }
 
 static inline bool excess_cached_nats(struct f2fs_sb_info *sbi)
 {
-	return NM_I(sbi)->nat_cnt >= DEF_NAT_CACHE_THRESHOLD;
+	return nat_cache_count(NM_I(sbi)) >= DEF_NAT_CACHE_THRESHOLD;
 }
 
 enum mem_type {
@@ -148,6 +208,7 @@ struct nat_entry_set {
 	struct list_head entry_list;	/* link with dirty nat entries */
 	nid_t set;			/* set number*/
 	unsigned int entry_cnt;		/* the # of nat entries in set */
+	unsigned int heat;		/* update frequency of the NAT block */
 };
 
 /*
@@ -164,6 +225,19 @@ struct free_nid {
 	int state;		/* in use or not: NID_NEW or NID_ALLOC */
 };
 
+/*
+ * Per-cpu cache of free nids reserved from the free nid list. They are
+ * kept on ALLOC_NID_LIST and not counted in available_nids.
+ */
+#define NID_MAG_SIZE		16
+#define NID_MAG_BATCH		(NID_MAG_SIZE / 2)
+
+struct free_nid_magazine {
+	spinlock_t lock;		/* protect nids, nr */
+	unsigned int nr;		/* the # of reserved nids */
+	struct free_nid *nids[NID_MAG_SIZE];
+};
+
 static inline void next_free_nid(struct f2fs_sb_info *sbi, nid_t *nid)
 {
 	struct f2fs_nm_info *nm_i = NM_I(sbi);
@@ -399,6 +473,28 @@ static inline void clear_cold_data(struct page *page)
 	ClearPageChecked(page);
 }
 
+/*
+ * Node pages migrated by GC are tagged in page cache until they are written,
+ * so that they are placed apart from freshly updated node blocks. Inode pages
+ * use PageChecked for inline data instead, so they are never tagged.
+ */
+static inline int is_gc_node(struct page *page)
+{
+	return !IS_INODE(page) && PageChecked(page);
+}
+
+static inline void set_gc_node(struct page *page)
+{
+	if (!IS_INODE(page))
+		SetPageChecked(page);
+}
+
+static inline void clear_gc_node(struct page *page)
+{
+	if (!IS_INODE(page))
+		ClearPageChecked(page);
+}
+
 static inline int is_node(struct page *page, int type)
 {
 	struct f2fs_node *rn = F2FS_NODE(page);
@@ -284,6 +284,10 @@ static int check_index_in_prev_nodes(struct f2fs_sb_info *sbi,
 	block_t bidx;
 	int i;
 
+	mutex_lock(&SIT_I(sbi)->sentry_lock);
+	load_seg_entry(sbi, segno);
+	mutex_unlock(&SIT_I(sbi)->sentry_lock);
+
 	sentry = get_seg_entry(sbi, segno);
 	if (!f2fs_test_bit(blkoff, sentry->cur_valid_map))
 		return 0;
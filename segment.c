@@ -14,6 +14,7 @@
 #include <linux/blkdev.h>
 #include <linux/prefetch.h>
 #include <linux/kthread.h>
+#include <linux/list_sort.h>
 #include <linux/swap.h>
 #include <linux/timer.h>
 
@@ -30,7 +31,7 @@
 #define __reverse_ffz(x) __reverse_ffs(~(x))
 
 static struct kmem_cache *discard_entry_slab;
-static struct kmem_cache *bio_entry_slab;
+static struct kmem_cache *discard_cmd_slab;
 static struct kmem_cache *sit_entry_set_slab;
 static struct kmem_cache *inmem_entry_slab;
 
@@ -367,8 +368,8 @@ void f2fs_balance_fs(struct f2fs_sb_info *sbi, bool need)
 	 * dir/node pages without enough free segments.
 	 */
 	if (has_not_enough_free_secs(sbi, 0, 0)) {
-		mutex_lock(&sbi->gc_mutex);
-		f2fs_gc(sbi, false, false);
+		down_write(&sbi->gc_lock);
+		f2fs_gc(sbi, false, false, ALL_DEVICES);
 	}
 }
 
@@ -385,7 +386,7 @@ void f2fs_balance_fs_bg(struct f2fs_sb_info *sbi)
 	if (!available_free_memory(sbi, FREE_NIDS))
 		try_to_free_nids(sbi, MAX_FREE_NIDS);
 	else
-		build_free_nids(sbi, false);
+		wake_up_nid_refill(sbi);
 
 	if (!is_idle(sbi))
 		return;
@@ -560,8 +561,11 @@ static void __locate_dirty_segment(struct f2fs_sb_info *sbi, unsigned int segno,
 	if (IS_CURSEG(sbi, segno))
 		return;
 
-	if (!test_and_set_bit(segno, dirty_i->dirty_segmap[dirty_type]))
+	if (!test_and_set_bit(segno, dirty_i->dirty_segmap[dirty_type])) {
 		dirty_i->nr_dirty[dirty_type]++;
+		if (dirty_type == DIRTY && dirty_i->dirty_segs_in_sec)
+			dirty_i->dirty_segs_in_sec[GET_SECNO(sbi, segno)]++;
+	}
 
 	if (dirty_type == DIRTY) {
 		struct seg_entry *sentry = get_seg_entry(sbi, segno);
@@ -581,8 +585,11 @@ static void __remove_dirty_segment(struct f2fs_sb_info *sbi, unsigned int segno,
 {
 	struct dirty_seglist_info *dirty_i = DIRTY_I(sbi);
 
-	if (test_and_clear_bit(segno, dirty_i->dirty_segmap[dirty_type]))
+	if (test_and_clear_bit(segno, dirty_i->dirty_segmap[dirty_type])) {
 		dirty_i->nr_dirty[dirty_type]--;
+		if (dirty_type == DIRTY && dirty_i->dirty_segs_in_sec)
+			dirty_i->dirty_segs_in_sec[GET_SECNO(sbi, segno)]--;
+	}
 
 	if (dirty_type == DIRTY) {
 		struct seg_entry *sentry = get_seg_entry(sbi, segno);
@@ -633,88 +640,433 @@ static void locate_dirty_segment(struct f2fs_sb_info *sbi, unsigned int segno)
 #endif
 }
 
-static struct bio_entry *__add_bio_entry(struct f2fs_sb_info *sbi,
-							struct bio *bio)
+/*
+ * Record the sections fully covered by a completed discard, so that
+ * allocation can prefer them over sections still holding stale data.
+ */
+static void __mark_trimmed_sections(struct f2fs_sb_info *sbi,
+					struct discard_cmd *dc)
 {
-	struct list_head *wait_list = &(SM_I(sbi)->wait_list);
-	struct bio_entry *be = f2fs_kmem_cache_alloc(bio_entry_slab, GFP_NOFS);
+	unsigned int blks_per_sec;
+	block_t start, end;
+	unsigned int secno;
+
+	if (dc->lstart < MAIN_BLKADDR(sbi))
+		return;
+
+	blks_per_sec = sbi->segs_per_sec << sbi->log_blocks_per_seg;
+	start = dc->lstart - MAIN_BLKADDR(sbi);
+	end = start + dc->len;
 
-	INIT_LIST_HEAD(&be->list);
-	be->bio = bio;
-	init_completion(&be->event);
-	list_add_tail(&be->list, wait_list);
+	for (secno = DIV_ROUND_UP(start, blks_per_sec);
+			secno < end / blks_per_sec; secno++)
+		set_bit(secno, FREE_I(sbi)->trimmed_secmap);
+}
 
-	return be;
+/*
+ * Discard ranges never overlap, since a block is punched out of them before
+ * it is reused, so the tree can be searched by lstart alone.
+ */
+static struct discard_cmd *__lookup_discard_cmd(struct discard_cmd_control *dcc,
+						block_t blkaddr)
+{
+	struct rb_node *node = dcc->root.rb_node;
+	struct discard_cmd *dc;
+
+	while (node) {
+		dc = rb_entry(node, struct discard_cmd, rb_node);
+		if (blkaddr < dc->lstart)
+			node = node->rb_left;
+		else if (blkaddr >= dc->lstart + dc->len)
+			node = node->rb_right;
+		else
+			return dc;
+	}
+	return NULL;
 }
 
-void f2fs_wait_all_discard_bio(struct f2fs_sb_info *sbi)
+static void __insert_discard_cmd(struct discard_cmd_control *dcc,
+						struct discard_cmd *dc)
 {
-	struct list_head *wait_list = &(SM_I(sbi)->wait_list);
-	struct bio_entry *be, *tmp;
+	struct rb_node **p = &dcc->root.rb_node;
+	struct rb_node *parent = NULL;
+	struct discard_cmd *cur;
 
-	list_for_each_entry_safe(be, tmp, wait_list, list) {
-		struct bio *bio = be->bio;
-		int err;
+	while (*p) {
+		parent = *p;
+		cur = rb_entry(parent, struct discard_cmd, rb_node);
+		if (dc->lstart < cur->lstart)
+			p = &(*p)->rb_left;
+		else
+			p = &(*p)->rb_right;
+	}
+	rb_link_node(&dc->rb_node, parent, p);
+	rb_insert_color(&dc->rb_node, &dcc->root);
+}
 
-		wait_for_completion_io(&be->event);
-		err = be->error;
-		if (err == -EOPNOTSUPP)
-			err = 0;
+static void __remove_discard_cmd(struct f2fs_sb_info *sbi,
+					struct discard_cmd *dc)
+{
+	struct discard_cmd_control *dcc = SM_I(sbi)->dcc_info;
+	int err = dc->error;
 
-		if (err)
-			f2fs_msg(sbi->sb, KERN_INFO,
-				"Issue discard failed, ret: %d", err);
+	f2fs_bug_on(sbi, dc->ref);
 
-		bio_put(bio);
-		list_del(&be->list);
-		kmem_cache_free(bio_entry_slab, be);
-	}
+	if (dc->state == D_DONE && !err)
+		__mark_trimmed_sections(sbi, dc);
+
+	if (err == -EOPNOTSUPP)
+		err = 0;
+	if (err)
+		f2fs_msg(sbi->sb, KERN_INFO,
+			"Issue discard failed, ret: %d", err);
+
+	if (dc->bio)
+		bio_put(dc->bio);
+	list_del(&dc->list);
+	rb_erase(&dc->rb_node, &dcc->root);
+	atomic_dec(&dcc->discard_cmd_cnt);
+	kmem_cache_free(discard_cmd_slab, dc);
+}
+
+static struct discard_cmd *__create_discard_cmd(struct f2fs_sb_info *sbi,
+		struct block_device *bdev, block_t lstart, block_t len)
+{
+	struct discard_cmd_control *dcc = SM_I(sbi)->dcc_info;
+	struct discard_cmd *dc;
+
+	dc = f2fs_kmem_cache_alloc(discard_cmd_slab, GFP_NOFS);
+	INIT_LIST_HEAD(&dc->list);
+	dc->bdev = bdev;
+	dc->lstart = lstart;
+	dc->len = len;
+	dc->bio = NULL;
+	init_completion(&dc->wait);
+	dc->state = D_PREP;
+	dc->error = 0;
+	dc->ref = 0;
+	__insert_discard_cmd(dcc, dc);
+	atomic_inc(&dcc->discard_cmd_cnt);
+	return dc;
 }
 
-static void f2fs_submit_bio_wait_endio(struct bio *bio)
+/*
+ * The command is freed by whoever sees it done last, so it is completed
+ * for all and may be waited on more than once.
+ */
+static void f2fs_submit_discard_endio(struct bio *bio)
 {
-	struct bio_entry *be = (struct bio_entry *)bio->bi_private;
+	struct discard_cmd *dc = (struct discard_cmd *)bio->bi_private;
 
-	be->error = bio->bi_error;
-	complete(&be->event);
+	dc->error = bio->bi_error;
+	dc->state = D_DONE;
+	complete_all(&dc->wait);
 }
 
 /* this function is copied from blkdev_issue_discard from block/blk-lib.c */
-static int __f2fs_issue_discard_async(struct f2fs_sb_info *sbi,
-		struct block_device *bdev, block_t blkstart, block_t blklen)
+static void __submit_discard_cmd(struct f2fs_sb_info *sbi,
+				struct discard_cmd *dc)
 {
-	struct bio *bio = NULL;
+	block_t blkstart = dc->lstart;
 	int err;
 
-	trace_f2fs_issue_discard(sbi->sb, blkstart, blklen);
+	trace_f2fs_issue_discard(sbi->sb, dc->lstart, dc->len);
 
 	if (sbi->s_ndevs) {
 		int devi = f2fs_target_device_index(sbi, blkstart);
 
 		blkstart -= FDEV(devi).start_blk;
 	}
-	err = __blkdev_issue_discard(bdev,
+
+	dc->state = D_SUBMIT;
+	list_move_tail(&dc->list, &SM_I(sbi)->dcc_info->discard_wait_list);
+	err = __blkdev_issue_discard(dc->bdev,
 				SECTOR_FROM_BLOCK(blkstart),
-				SECTOR_FROM_BLOCK(blklen),
-				GFP_NOFS, 0, &bio);
-	if (!err && bio) {
-		struct bio_entry *be = __add_bio_entry(sbi, bio);
+				SECTOR_FROM_BLOCK(dc->len),
+				GFP_NOFS, 0, &dc->bio);
+	if (!err && dc->bio) {
+		dc->bio->bi_private = dc;
+		dc->bio->bi_end_io = f2fs_submit_discard_endio;
+		dc->bio->bi_opf |= REQ_SYNC;
+		submit_bio(dc->bio);
+		return;
+	}
+
+	dc->error = err;
+	dc->state = D_DONE;
+	complete_all(&dc->wait);
+}
+
+/*
+ * Wait for a submitted command without cmd_lock held. The reference keeps
+ * it in the list until the last waiter is done with it.
+ */
+static void __wait_discard_cmd(struct f2fs_sb_info *sbi,
+					struct discard_cmd *dc)
+{
+	struct discard_cmd_control *dcc = SM_I(sbi)->dcc_info;
+
+	dc->ref++;
+	mutex_unlock(&dcc->cmd_lock);
+
+	wait_for_completion_io(&dc->wait);
+
+	mutex_lock(&dcc->cmd_lock);
+	if (!--dc->ref)
+		__remove_discard_cmd(sbi, dc);
+}
+
+/*
+ * Drop a block which is about to be reused from a queued discard, so that
+ * the discard cannot be issued after new data lands on that block.
+ */
+static void __punch_discard_cmd(struct f2fs_sb_info *sbi,
+				struct discard_cmd *dc, block_t blkaddr)
+{
+	struct discard_cmd *tail;
+	block_t end = dc->lstart + dc->len;
+
+	if (dc->len == 1) {
+		__remove_discard_cmd(sbi, dc);
+		return;
+	}
+
+	if (blkaddr == dc->lstart) {
+		dc->lstart++;
+		dc->len--;
+	} else if (blkaddr == end - 1) {
+		dc->len--;
+	} else {
+		tail = __create_discard_cmd(sbi, dc->bdev,
+					blkaddr + 1, end - blkaddr - 1);
+		list_add(&tail->list, &dc->list);
+		dc->len = blkaddr - dc->lstart;
+	}
+}
+
+static void __queue_discard_cmd(struct f2fs_sb_info *sbi,
+		struct block_device *bdev, block_t blkstart, block_t blklen)
+{
+	struct discard_cmd_control *dcc = SM_I(sbi)->dcc_info;
+	struct list_head *head = &dcc->discard_pend_list;
+	struct discard_cmd *dc;
+	bool wake = false;
+
+	mutex_lock(&dcc->cmd_lock);
+
+	/* candidates mostly come in ascending order, so merge at the tail */
+	if (!list_empty(head)) {
+		dc = list_last_entry(head, struct discard_cmd, list);
+		if (dc->bdev == bdev && dc->lstart + dc->len == blkstart) {
+			dc->len += blklen;
+			goto out;
+		}
+	} else {
+		/* the thread paces itself, so only tell it there is work */
+		dcc->discard_wake = 1;
+		wake = true;
+	}
+
+	dc = __create_discard_cmd(sbi, bdev, blkstart, blklen);
+	list_add_tail(&dc->list, head);
+out:
+	mutex_unlock(&dcc->cmd_lock);
+
+	if (wake)
+		wake_up_interruptible_all(&dcc->discard_wait_queue);
+}
+
+/*
+ * Issue up to @nr_issue queued discards, and release completed ones.
+ * Return the number of discards issued.
+ */
+static int __issue_discard_cmds(struct f2fs_sb_info *sbi, int nr_issue)
+{
+	struct discard_cmd_control *dcc = SM_I(sbi)->dcc_info;
+	struct discard_cmd *dc, *tmp;
+	struct blk_plug plug;
+	int issued = 0;
+
+	mutex_lock(&dcc->cmd_lock);
+
+	/* release completed ones in issue order, up to the first busy one */
+	list_for_each_entry_safe(dc, tmp, &dcc->discard_wait_list, list) {
+		if (dc->state != D_DONE || dc->ref)
+			break;
+		/* the endio may not be out of complete_all() yet */
+		wait_for_completion_io(&dc->wait);
+		__remove_discard_cmd(sbi, dc);
+	}
+
+	blk_start_plug(&plug);
+	list_for_each_entry_safe(dc, tmp, &dcc->discard_pend_list, list) {
+		if (issued >= nr_issue)
+			break;
+		__submit_discard_cmd(sbi, dc);
+		issued++;
+	}
+	blk_finish_plug(&plug);
+	mutex_unlock(&dcc->cmd_lock);
+
+	return issued;
+}
+
+/*
+ * Wait for the discards covering @blkaddr, or for all the discards including
+ * queued ones if @blkaddr is NULL_ADDR.
+ */
+void f2fs_wait_discard_bio(struct f2fs_sb_info *sbi, block_t blkaddr)
+{
+	struct discard_cmd_control *dcc = SM_I(sbi)->dcc_info;
+	struct list_head *head;
+	struct discard_cmd *dc, *last, *next;
+
+	/* nothing queued nor in flight, as on most block writes */
+	if (!dcc || RB_EMPTY_ROOT(&dcc->root))
+		return;
 
-		bio->bi_private = be;
-		bio->bi_end_io = f2fs_submit_bio_wait_endio;
-		bio->bi_opf |= REQ_SYNC;
-		submit_bio(bio);
+	if (blkaddr != NULL_ADDR) {
+		mutex_lock(&dcc->cmd_lock);
+		dc = __lookup_discard_cmd(dcc, blkaddr);
+		if (dc && dc->state == D_PREP)
+			__punch_discard_cmd(sbi, dc, blkaddr);
+		else if (dc)
+			__wait_discard_cmd(sbi, dc);
+		mutex_unlock(&dcc->cmd_lock);
+		return;
+	}
+
+	/* submit them all at once rather than one by one below */
+	__issue_discard_cmds(sbi, INT_MAX);
+
+	head = &dcc->discard_wait_list;
+	mutex_lock(&dcc->cmd_lock);
+	if (list_empty(head))
+		goto out;
+
+	/* the last one is pinned to stop at, commands issued later are not */
+	last = list_last_entry(head, struct discard_cmd, list);
+	last->ref++;
+
+	dc = list_first_entry(head, struct discard_cmd, list);
+	while (dc != last) {
+		/* the pinned last one keeps dc from being the list tail */
+		dc->ref++;
+		mutex_unlock(&dcc->cmd_lock);
+		wait_for_completion_io(&dc->wait);
+		mutex_lock(&dcc->cmd_lock);
+		next = list_next_entry(dc, list);
+		if (!--dc->ref)
+			__remove_discard_cmd(sbi, dc);
+		dc = next;
+	}
+	last->ref--;
+	__wait_discard_cmd(sbi, last);
+out:
+	mutex_unlock(&dcc->cmd_lock);
+}
+
+static int issue_discard_thread(void *data)
+{
+	struct f2fs_sb_info *sbi = data;
+	struct discard_cmd_control *dcc = SM_I(sbi)->dcc_info;
+	wait_queue_head_t *q = &dcc->discard_wait_queue;
+	long wait_ms = DEF_MAX_DISCARD_ISSUE_TIME;
+	unsigned long deferred_since = 0;
+	bool idle;
+
+	do {
+		wait_event_interruptible_timeout(*q,
+				kthread_should_stop() || dcc->discard_wake,
+				msecs_to_jiffies(wait_ms));
+		if (try_to_freeze())
+			continue;
+		if (kthread_should_stop())
+			break;
+
+		dcc->discard_wake = 0;
+
+		if (!atomic_read(&dcc->discard_cmd_cnt)) {
+			wait_ms = DEF_MAX_DISCARD_ISSUE_TIME;
+			deferred_since = 0;
+			continue;
+		}
+
+		/*
+		 * Discards yield to user I/O, but a busy device still gets a
+		 * batch once they have been deferred for
+		 * DEF_MAX_DISCARD_ISSUE_TIME, so they drain.
+		 */
+		idle = is_idle(sbi);
+		if (!idle && !deferred_since)
+			deferred_since = jiffies;
+
+		if (idle || time_after_eq(jiffies, deferred_since +
+				msecs_to_jiffies(DEF_MAX_DISCARD_ISSUE_TIME))) {
+			__issue_discard_cmds(sbi, DEF_MAX_DISCARD_REQUEST);
+			wait_ms = DEF_MIN_DISCARD_ISSUE_TIME;
+			deferred_since = 0;
+		} else {
+			wait_ms = jiffies_to_msecs(deferred_since +
+				msecs_to_jiffies(DEF_MAX_DISCARD_ISSUE_TIME) -
+				jiffies);
+		}
+	} while (!kthread_should_stop());
+	return 0;
+}
+
+static int create_discard_cmd_control(struct f2fs_sb_info *sbi)
+{
+	dev_t dev = sbi->sb->s_bdev->bd_dev;
+	struct discard_cmd_control *dcc;
+	int err = 0;
+
+	dcc = kzalloc(sizeof(struct discard_cmd_control), GFP_KERNEL);
+	if (!dcc)
+		return -ENOMEM;
+
+	init_waitqueue_head(&dcc->discard_wait_queue);
+	mutex_init(&dcc->cmd_lock);
+	INIT_LIST_HEAD(&dcc->discard_pend_list);
+	INIT_LIST_HEAD(&dcc->discard_wait_list);
+	dcc->root = RB_ROOT;
+	atomic_set(&dcc->discard_cmd_cnt, 0);
+	SM_I(sbi)->dcc_info = dcc;
+
+	dcc->f2fs_issue_discard = kthread_run(issue_discard_thread, sbi,
+				"f2fs_discard-%u:%u", MAJOR(dev), MINOR(dev));
+	if (IS_ERR(dcc->f2fs_issue_discard)) {
+		err = PTR_ERR(dcc->f2fs_issue_discard);
+		kfree(dcc);
+		SM_I(sbi)->dcc_info = NULL;
 	}
 
 	return err;
 }
 
+static void destroy_discard_cmd_control(struct f2fs_sb_info *sbi)
+{
+	struct discard_cmd_control *dcc = SM_I(sbi)->dcc_info;
+
+	if (!dcc)
+		return;
+
+	kthread_stop(dcc->f2fs_issue_discard);
+
+	/* drain what the thread left behind */
+	f2fs_wait_discard_bio(sbi, NULL_ADDR);
+
+	kfree(dcc);
+	SM_I(sbi)->dcc_info = NULL;
+}
+
 #ifdef CONFIG_BLK_DEV_ZONED
 static int __f2fs_issue_discard_zone(struct f2fs_sb_info *sbi,
 		struct block_device *bdev, block_t blkstart, block_t blklen)
 {
 	sector_t nr_sects = SECTOR_FROM_BLOCK(blklen);
 	sector_t sector;
+	block_t lblkstart = blkstart;
 	int devi = 0;
 
 	if (sbi->s_ndevs) {
@@ -742,7 +1094,8 @@ static int __f2fs_issue_discard_zone(struct f2fs_sb_info *sbi,
 	case BLK_ZONE_TYPE_CONVENTIONAL:
 		if (!blk_queue_discard(bdev_get_queue(bdev)))
 			return 0;
-		return __f2fs_issue_discard_async(sbi, bdev, blkstart, blklen);
+		__queue_discard_cmd(sbi, bdev, lblkstart, blklen);
+		return 0;
 	case BLK_ZONE_TYPE_SEQWRITE_REQ:
 	case BLK_ZONE_TYPE_SEQWRITE_PREF:
 		trace_f2fs_issue_reset_zone(sbi->sb, blkstart);
@@ -763,7 +1116,8 @@ static int __issue_discard_async(struct f2fs_sb_info *sbi,
 				bdev_zoned_model(bdev) != BLK_ZONED_NONE)
 		return __f2fs_issue_discard_zone(sbi, bdev, blkstart, blklen);
 #endif
-	return __f2fs_issue_discard_async(sbi, bdev, blkstart, blklen);
+	__queue_discard_cmd(sbi, bdev, blkstart, blklen);
+	return 0;
 }
 
 static int f2fs_issue_discard(struct f2fs_sb_info *sbi,
@@ -847,6 +1201,8 @@ static void add_discard_addrs(struct f2fs_sb_info *sbi, struct cp_control *cpc)
 	if (se->valid_blocks == max_blocks || !f2fs_discard_en(sbi))
 		return;
 
+	load_seg_entry(sbi, cpc->trim_start);
+
 	if (!force) {
 		if (!test_opt(sbi, DISCARD) || !se->valid_blocks ||
 		    SM_I(sbi)->nr_discards >= SM_I(sbi)->max_discards)
@@ -887,13 +1243,14 @@ void release_discard_addrs(struct f2fs_sb_info *sbi)
 /*
  * Should call clear_prefree_segments after checkpoint is done.
  */
-static void set_prefree_as_free_segments(struct f2fs_sb_info *sbi)
+static void set_prefree_as_free_segments(struct f2fs_sb_info *sbi,
+						unsigned long *prefree_map)
 {
 	struct dirty_seglist_info *dirty_i = DIRTY_I(sbi);
 	unsigned int segno;
 
 	mutex_lock(&dirty_i->seglist_lock);
-	for_each_set_bit(segno, dirty_i->dirty_segmap[PRE], MAIN_SEGS(sbi))
+	for_each_set_bit(segno, prefree_map, MAIN_SEGS(sbi))
 		__set_test_and_free(sbi, segno);
 	mutex_unlock(&dirty_i->seglist_lock);
 }
@@ -905,6 +1262,7 @@ void clear_prefree_segments(struct f2fs_sb_info *sbi, struct cp_control *cpc)
 	struct dirty_seglist_info *dirty_i = DIRTY_I(sbi);
 	struct blk_plug plug;
 	unsigned long *prefree_map = dirty_i->dirty_segmap[PRE];
+	unsigned long *cp_map = cpc->prefree_map ? : prefree_map;
 	unsigned int start = 0, end = -1;
 	unsigned int secno, start_segno;
 	bool force = (cpc->reason == CP_DISCARD);
@@ -915,11 +1273,10 @@ void clear_prefree_segments(struct f2fs_sb_info *sbi, struct cp_control *cpc)
 
 	while (1) {
 		int i;
-		start = find_next_bit(prefree_map, MAIN_SEGS(sbi), end + 1);
+		start = find_next_bit(cp_map, MAIN_SEGS(sbi), end + 1);
 		if (start >= MAIN_SEGS(sbi))
 			break;
-		end = find_next_zero_bit(prefree_map, MAIN_SEGS(sbi),
-								start + 1);
+		end = find_next_zero_bit(cp_map, MAIN_SEGS(sbi), start + 1);
 
 		for (i = start; i < end; i++)
 			clear_bit(i, prefree_map);
@@ -933,7 +1290,12 @@ void clear_prefree_segments(struct f2fs_sb_info *sbi, struct cp_control *cpc)
 					(end - 1) <= cpc->trim_end)
 				continue;
 
-		if (!test_opt(sbi, LFS) || sbi->segs_per_sec == 1) {
+		/*
+		 * Other segments of the section may be allocated again once
+		 * a snapshot checkpoint has unblocked operations.
+		 */
+		if (!test_opt(sbi, LFS) || sbi->segs_per_sec == 1 ||
+							cpc->prefree_map) {
 			f2fs_issue_discard(sbi, START_BLOCK(sbi, start),
 				(end - start) << sbi->log_blocks_per_seg);
 			continue;
@@ -952,6 +1314,10 @@ next:
 	}
 	mutex_unlock(&dirty_i->seglist_lock);
 
+	/* queue their discards first, so that new writes wait for them */
+	if (cpc->prefree_map)
+		set_prefree_as_free_segments(sbi, cpc->prefree_map);
+
 	/* send small discards */
 	list_for_each_entry_safe(entry, this, head, list) {
 		if (force && entry->len < cpc->trim_minlen)
@@ -996,6 +1362,7 @@ static void update_sit_entry(struct f2fs_sb_info *sbi, block_t blkaddr, int del)
 
 	segno = GET_SEGNO(sbi, blkaddr);
 
+	load_seg_entry(sbi, segno);
 	se = get_seg_entry(sbi, segno);
 	new_vblocks = se->valid_blocks + del;
 	offset = GET_BLKOFF_FROM_SEG0(sbi, blkaddr);
@@ -1076,6 +1443,7 @@ bool is_checkpointed_data(struct f2fs_sb_info *sbi, block_t blkaddr)
 	mutex_lock(&sit_i->sentry_lock);
 
 	segno = GET_SEGNO(sbi, blkaddr);
+	load_seg_entry(sbi, segno);
 	se = get_seg_entry(sbi, segno);
 	offset = GET_BLKOFF_FROM_SEG0(sbi, blkaddr);
 
@@ -1192,11 +1560,74 @@ static int is_next_segment_free(struct f2fs_sb_info *sbi, int type)
 	return 0;
 }
 
+static void __refill_sec_pool(struct f2fs_sb_info *sbi,
+				struct curseg_info *curseg, unsigned int hint)
+{
+	struct free_segmap_info *free_i = FREE_I(sbi);
+	unsigned int end = min(hint + SEC_TRIM_WINDOW, MAIN_SECS(sbi));
+	unsigned int secno = hint;
+	int i = 0;
+
+	/* prefer free sections whose discards have already completed */
+	while (i < SEC_POOL_SIZE) {
+		secno = find_next_bit(free_i->trimmed_secmap, end, secno);
+		if (secno >= end)
+			break;
+		if (!test_bit(secno, free_i->free_secmap))
+			curseg->sec_pool[i++] = secno;
+		secno++;
+	}
+	if (i)
+		goto out;
+
+	for (secno = hint; i < SEC_POOL_SIZE; i++) {
+		secno = find_next_zero_bit(free_i->free_secmap,
+						MAIN_SECS(sbi), secno);
+		if (secno >= MAIN_SECS(sbi))
+			break;
+		curseg->sec_pool[i] = secno++;
+	}
+out:
+	curseg->sec_pool_pos = 0;
+	curseg->sec_pool_cnt = i;
+}
+
+/*
+ * Free sections are looked up in batches per log, so that most section
+ * switches do not rescan free_secmap. Entries are not reserved; the ones
+ * taken by other logs in the meantime are skipped here.
+ * This should be called with segmap_lock held.
+ */
+static unsigned int __get_pooled_section(struct f2fs_sb_info *sbi,
+				struct curseg_info *curseg, unsigned int hint)
+{
+	struct free_segmap_info *free_i = FREE_I(sbi);
+	unsigned int secno;
+
+	while (1) {
+		if (curseg->sec_pool_pos >= curseg->sec_pool_cnt) {
+			__refill_sec_pool(sbi, curseg, hint);
+			if (!curseg->sec_pool_cnt)
+				return NULL_SECNO;
+		}
+
+		secno = curseg->sec_pool[curseg->sec_pool_pos++];
+
+		/* the log moved behind the pool, so look up from its hint */
+		if (secno < hint) {
+			curseg->sec_pool_cnt = 0;
+			continue;
+		}
+		if (!test_bit(secno, free_i->free_secmap))
+			return secno;
+	}
+}
+
 /*
  * Find a new segment from the free segments bitmap to right order
  * This function should be returned with success, otherwise BUG
  */
-static void get_new_segment(struct f2fs_sb_info *sbi,
+static void get_new_segment(struct f2fs_sb_info *sbi, int type,
 			unsigned int *newseg, bool new_sec, int dir)
 {
 	struct free_segmap_info *free_i = FREE_I(sbi);
@@ -1217,6 +1648,15 @@ static void get_new_segment(struct f2fs_sb_info *sbi,
 		if (segno < (hint + 1) * sbi->segs_per_sec)
 			goto got_it;
 	}
+
+	/* no zone to stay away from, so take the next pooled section */
+	if (sbi->secs_per_zone == 1) {
+		secno = __get_pooled_section(sbi, CURSEG_I(sbi, type), hint);
+		if (secno != NULL_SECNO) {
+			segno = secno * sbi->segs_per_sec;
+			goto got_it;
+		}
+	}
 find_other_zone:
 	secno = find_next_zero_bit(free_i->free_secmap, MAIN_SECS(sbi), hint);
 	if (secno >= MAIN_SECS(sbi)) {
@@ -1321,7 +1761,7 @@ static void new_curseg(struct f2fs_sb_info *sbi, int type, bool new_sec)
 	if (test_opt(sbi, NOHEAP))
 		dir = ALLOC_RIGHT;
 
-	get_new_segment(sbi, &segno, new_sec, dir);
+	get_new_segment(sbi, type, &segno, new_sec, dir);
 	curseg->next_segno = segno;
 	reset_curseg(sbi, type, 1);
 	curseg->alloc_type = LFS;
@@ -1337,6 +1777,8 @@ static void __next_free_blkoff(struct f2fs_sb_info *sbi,
 	unsigned long *cur_map = (unsigned long *)se->cur_valid_map;
 	int i, pos;
 
+	load_seg_entry(sbi, seg->segno);
+
 	for (i = 0; i < entries; i++)
 		target_map[i] = ckpt_map[i] | cur_map[i];
 
@@ -1398,13 +1840,13 @@ static int get_ssr_segment(struct f2fs_sb_info *sbi, int type)
 	const struct victim_selection *v_ops = DIRTY_I(sbi)->v_ops;
 
 	if (IS_NODESEG(type) || !has_not_enough_free_secs(sbi, 0, 0))
-		return v_ops->get_victim(sbi,
-				&(curseg)->next_segno, BG_GC, type, SSR);
+		return v_ops->get_victim(sbi, &(curseg)->next_segno,
+					BG_GC, type, SSR, ALL_DEVICES);
 
 	/* For data segments, let's do SSR more intensively */
 	for (; type >= CURSEG_HOT_DATA; type--)
 		if (v_ops->get_victim(sbi, &(curseg)->next_segno,
-						BG_GC, type, SSR))
+					BG_GC, type, SSR, ALL_DEVICES))
 			return 1;
 	return 0;
 }
@@ -1492,9 +1934,9 @@ int f2fs_trim_fs(struct f2fs_sb_info *sbi, struct fstrim_range *range)
 				BATCHED_TRIM_SEGMENTS(sbi),
 				sbi->segs_per_sec) - 1, end_segno);
 
-		mutex_lock(&sbi->gc_mutex);
+		down_write(&sbi->gc_lock);
 		err = write_checkpoint(sbi, &cpc);
-		mutex_unlock(&sbi->gc_mutex);
+		up_write(&sbi->gc_lock);
 		if (err)
 			break;
 
@@ -1526,11 +1968,14 @@ static int __get_segment_type_4(struct page *page, enum page_type p_type)
 	if (p_type == DATA) {
 		struct inode *inode = page->mapping->host;
 
-		if (S_ISDIR(inode->i_mode))
+		if ((S_ISDIR(inode->i_mode) || file_is_hot(inode)) &&
+						!is_cold_data(page))
 			return CURSEG_HOT_DATA;
 		else
 			return CURSEG_COLD_DATA;
 	} else {
+		if (is_gc_node(page) && !is_fsync_dnode(page))
+			return CURSEG_COLD_NODE;
 		if (IS_DNODE(page) && is_cold_node(page))
 			return CURSEG_WARM_NODE;
 		else
@@ -1543,13 +1988,17 @@ static int __get_segment_type_6(struct page *page, enum page_type p_type)
 	if (p_type == DATA) {
 		struct inode *inode = page->mapping->host;
 
-		if (S_ISDIR(inode->i_mode))
-			return CURSEG_HOT_DATA;
-		else if (is_cold_data(page) || file_is_cold(inode))
+		/* blocks migrated by GC outlived their peers, so keep them cold */
+		if (is_cold_data(page) || file_is_cold(inode))
 			return CURSEG_COLD_DATA;
+		else if (S_ISDIR(inode->i_mode) || file_is_hot(inode))
+			return CURSEG_HOT_DATA;
 		else
 			return CURSEG_WARM_DATA;
 	} else {
+		/* fsync'ed dnodes must stay in the warm chain for recovery */
+		if (is_gc_node(page) && !is_fsync_dnode(page))
+			return CURSEG_COLD_NODE;
 		if (IS_DNODE(page))
 			return is_cold_node(page) ? CURSEG_WARM_NODE :
 						CURSEG_HOT_NODE;
@@ -1621,6 +2070,9 @@ static void do_write_page(struct f2fs_summary *sum, struct f2fs_io_info *fio)
 	allocate_data_block(fio->sbi, fio->page, fio->old_blkaddr,
 					&fio->new_blkaddr, sum, type);
 
+	/* a pending discard must not reach the device after this write */
+	f2fs_wait_discard_bio(fio->sbi, fio->new_blkaddr);
+
 	/* writeout dirty page into bdev */
 	f2fs_submit_page_mbio(fio);
 
@@ -2061,32 +2513,54 @@ static struct page *get_current_sit_page(struct f2fs_sb_info *sbi,
 	return get_meta_page(sbi, current_sit_addr(sbi, segno));
 }
 
-static struct page *get_next_sit_page(struct f2fs_sb_info *sbi,
-					unsigned int start)
+/*
+ * Fill in the bitmaps of the lazy segments in [start, end), which must share
+ * a SIT block. Lazy entries have never been dirtied, so the current SIT
+ * block still holds what they had at mount.
+ * This should be called with sentry_lock held.
+ */
+static void __load_lazy_entries(struct f2fs_sb_info *sbi,
+				unsigned int start, unsigned int end)
 {
 	struct sit_info *sit_i = SIT_I(sbi);
-	struct page *src_page, *dst_page;
-	pgoff_t src_off, dst_off;
-	void *src_addr, *dst_addr;
+	struct f2fs_sit_block *sit_blk;
+	struct page *page;
+	unsigned int segno;
 
-	src_off = current_sit_addr(sbi, start);
-	dst_off = next_sit_addr(sbi, src_off);
+	page = get_current_sit_page(sbi, start);
+	sit_blk = (struct f2fs_sit_block *)page_address(page);
 
-	/* get current sit block page without lock */
-	src_page = get_meta_page(sbi, src_off);
-	dst_page = grab_meta_page(sbi, dst_off);
-	f2fs_bug_on(sbi, PageDirty(src_page));
+	for (segno = start; segno < end; segno++) {
+		struct seg_entry *se = get_seg_entry(sbi, segno);
+		struct f2fs_sit_entry *sit;
 
-	src_addr = page_address(src_page);
-	dst_addr = page_address(dst_page);
-	memcpy(dst_addr, src_addr, PAGE_SIZE);
+		if (!test_bit(segno, sit_i->lazy_segmap))
+			continue;
 
-	set_page_dirty(dst_page);
-	f2fs_put_page(src_page, 1);
+		sit = &sit_blk->entries[SIT_ENTRY_OFFSET(sit_i, segno)];
+		check_block_count(sbi, segno, sit);
+		memcpy(se->cur_valid_map, sit->valid_map, SIT_VBLOCK_MAP_SIZE);
+		memcpy(se->ckpt_valid_map, sit->valid_map, SIT_VBLOCK_MAP_SIZE);
+		if (f2fs_discard_en(sbi))
+			memcpy(se->discard_map, sit->valid_map,
+						SIT_VBLOCK_MAP_SIZE);
+		clear_bit(segno, sit_i->lazy_segmap);
+	}
+	f2fs_put_page(page, 1);
+}
 
-	set_to_next_sit(sit_i, start);
+/*
+ * Make sure the bitmaps of a segment are in memory before they are used.
+ * This should be called with sentry_lock held.
+ */
+void load_seg_entry(struct f2fs_sb_info *sbi, unsigned int segno)
+{
+	struct sit_info *sit_i = SIT_I(sbi);
+
+	if (!sit_i->lazy_segmap || !test_bit(segno, sit_i->lazy_segmap))
+		return;
 
-	return dst_page;
+	__load_lazy_entries(sbi, segno, segno + 1);
 }
 
 static struct sit_entry_set *grab_sit_entry_set(void)
@@ -2095,6 +2569,8 @@ static struct sit_entry_set *grab_sit_entry_set(void)
 			f2fs_kmem_cache_alloc(sit_entry_set_slab, GFP_NOFS);
 
 	ses->entry_cnt = 0;
+	ses->page = NULL;
+	bitmap_zero(ses->entry_map, SIT_ENTRY_PER_BLOCK);
 	INIT_LIST_HEAD(&ses->set_list);
 	return ses;
 }
@@ -2172,6 +2648,86 @@ static void remove_sits_in_journal(struct f2fs_sb_info *sbi)
 	up_write(&curseg->journal_rwsem);
 }
 
+static int __sit_set_cmp(void *priv, struct list_head *a, struct list_head *b)
+{
+	struct sit_entry_set *sa, *sb;
+
+	sa = list_entry(a, struct sit_entry_set, set_list);
+	sb = list_entry(b, struct sit_entry_set, set_list);
+
+	if (sa->start_segno < sb->start_segno)
+		return -1;
+	return sa->start_segno > sb->start_segno;
+}
+
+static int __sit_heat_cmp(void *priv, struct list_head *a, struct list_head *b)
+{
+	struct sit_entry_set *sa, *sb;
+
+	sa = list_entry(a, struct sit_entry_set, set_list);
+	sb = list_entry(b, struct sit_entry_set, set_list);
+
+	return journal_set_cmp(sa->heat, sa->entry_cnt,
+					sb->heat, sb->entry_cnt);
+}
+
+/*
+ * Complete the next sit blocks staged by flush_sit_entries(), without
+ * sentry_lock held across I/O. The current blocks are read ahead in runs of
+ * adjacent sit blocks, and only the entries not staged are copied from them.
+ * The dirtied blocks then go out in order with the other meta pages.
+ */
+static void write_sit_pages(struct f2fs_sb_info *sbi, struct list_head *head)
+{
+	struct sit_info *sit_i = SIT_I(sbi);
+	struct sit_entry_set *ses, *tmp;
+	unsigned int start_blk = 0, nr_blks = 0;
+
+	list_sort(NULL, head, __sit_set_cmp);
+
+	list_for_each_entry(ses, head, set_list) {
+		unsigned int blk = SIT_BLOCK_OFFSET(ses->start_segno);
+
+		if (nr_blks && blk == start_blk + nr_blks) {
+			nr_blks++;
+			continue;
+		}
+		if (nr_blks)
+			ra_meta_pages(sbi, start_blk, nr_blks, META_SIT, true);
+		start_blk = blk;
+		nr_blks = 1;
+	}
+	if (nr_blks)
+		ra_meta_pages(sbi, start_blk, nr_blks, META_SIT, true);
+
+	list_for_each_entry_safe(ses, tmp, head, set_list) {
+		struct f2fs_sit_block *src, *dst = page_address(ses->page);
+		struct page *src_page;
+		unsigned int offset;
+
+		src_page = get_current_sit_page(sbi, ses->start_segno);
+		f2fs_bug_on(sbi, PageDirty(src_page));
+		src = page_address(src_page);
+
+		for_each_clear_bit(offset, ses->entry_map, SIT_ENTRY_PER_BLOCK)
+			dst->entries[offset] = src->entries[offset];
+		memcpy((char *)dst + sizeof(struct f2fs_sit_block),
+			(char *)src + sizeof(struct f2fs_sit_block),
+			PAGE_SIZE - sizeof(struct f2fs_sit_block));
+		f2fs_put_page(src_page, 1);
+
+		set_page_dirty(ses->page);
+		f2fs_put_page(ses->page, 1);
+
+		/* readers of the current block may only move on from here */
+		mutex_lock(&sit_i->sentry_lock);
+		set_to_next_sit(sit_i, ses->start_segno);
+		mutex_unlock(&sit_i->sentry_lock);
+
+		release_sit_entry_set(ses);
+	}
+}
+
 /*
  * CP calls this function, which flushes SIT entries including sit_journal,
  * and moves prefree segs to free segs.
@@ -2184,7 +2740,10 @@ void flush_sit_entries(struct f2fs_sb_info *sbi, struct cp_control *cpc)
 	struct f2fs_journal *journal = curseg->journal;
 	struct sit_entry_set *ses, *tmp;
 	struct list_head *head = &SM_I(sbi)->sit_entry_set;
-	bool to_journal = true;
+	struct f2fs_journal_stat *jstat = &sbi->jstat[SIT_JOURNAL];
+	unsigned short cp_ver = cur_cp_version(F2FS_CKPT(sbi));
+	LIST_HEAD(page_sets);
+	bool to_journal;
 	struct seg_entry *se;
 
 	mutex_lock(&sit_i->sentry_lock);
@@ -2206,10 +2765,17 @@ void flush_sit_entries(struct f2fs_sb_info *sbi, struct cp_control *cpc)
 	if (!__has_cursum_space(journal, sit_i->dirty_sentries, SIT_JOURNAL))
 		remove_sits_in_journal(sbi);
 
+	/* hot sparse sets take the journal first */
+	list_for_each_entry(ses, head, set_list)
+		ses->heat = update_journal_heat(&sit_i->sit_heat[
+				SIT_BLOCK_OFFSET(ses->start_segno)], cp_ver);
+	list_sort(NULL, head, __sit_heat_cmp);
+
 	/*
 	 * there are two steps to flush sit entries:
 	 * #1, flush sit entries to journal in current cold data summary block.
-	 * #2, flush sit entries to sit page.
+	 * #2, stage sit entries in next sit pages, which write_sit_pages()
+	 *     completes once sentry_lock is dropped.
 	 */
 	list_for_each_entry_safe(ses, tmp, head, set_list) {
 		struct page *page = NULL;
@@ -2219,14 +2785,16 @@ void flush_sit_entries(struct f2fs_sb_info *sbi, struct cp_control *cpc)
 						(unsigned long)MAIN_SEGS(sbi));
 		unsigned int segno = start_segno;
 
-		if (to_journal &&
-			!__has_cursum_space(journal, ses->entry_cnt, SIT_JOURNAL))
-			to_journal = false;
-
+		to_journal = __has_cursum_space(journal, ses->entry_cnt,
+							SIT_JOURNAL);
 		if (to_journal) {
+			jstat->jentries += ses->entry_cnt;
 			down_write(&curseg->journal_rwsem);
 		} else {
-			page = get_next_sit_page(sbi, start_segno);
+			jstat->bentries += ses->entry_cnt;
+			jstat->blocks++;
+			page = grab_meta_page(sbi, next_sit_addr(sbi,
+					current_sit_addr(sbi, start_segno)));
 			raw_sit = page_address(page);
 		}
 
@@ -2254,6 +2822,7 @@ void flush_sit_entries(struct f2fs_sb_info *sbi, struct cp_control *cpc)
 				sit_offset = SIT_ENTRY_OFFSET(sit_i, segno);
 				seg_info_to_raw_sit(se,
 						&raw_sit->entries[sit_offset]);
+				__set_bit(sit_offset, ses->entry_map);
 			}
 
 			__clear_bit(segno, bitmap);
@@ -2261,13 +2830,15 @@ void flush_sit_entries(struct f2fs_sb_info *sbi, struct cp_control *cpc)
 			ses->entry_cnt--;
 		}
 
-		if (to_journal)
-			up_write(&curseg->journal_rwsem);
-		else
-			f2fs_put_page(page, 1);
-
 		f2fs_bug_on(sbi, ses->entry_cnt);
-		release_sit_entry_set(ses);
+
+		if (to_journal) {
+			up_write(&curseg->journal_rwsem);
+			release_sit_entry_set(ses);
+		} else {
+			ses->page = page;
+			list_move_tail(&ses->set_list, &page_sets);
+		}
 	}
 
 	f2fs_bug_on(sbi, !list_empty(head));
@@ -2283,7 +2854,21 @@ out:
 	}
 	mutex_unlock(&sit_i->sentry_lock);
 
-	set_prefree_as_free_segments(sbi);
+	write_sit_pages(sbi, &page_sets);
+
+	/*
+	 * A snapshot checkpoint unblocks operations before it commits, so
+	 * its prefree segments may only be reused after that.
+	 */
+	if (cpc->prefree_map) {
+		mutex_lock(&DIRTY_I(sbi)->seglist_lock);
+		bitmap_copy(cpc->prefree_map, DIRTY_I(sbi)->dirty_segmap[PRE],
+							MAIN_SEGS(sbi));
+		mutex_unlock(&DIRTY_I(sbi)->seglist_lock);
+	} else {
+		set_prefree_as_free_segments(sbi,
+					DIRTY_I(sbi)->dirty_segmap[PRE]);
+	}
 }
 
 static int build_sit_info(struct f2fs_sb_info *sbi)
@@ -2292,7 +2877,8 @@ static int build_sit_info(struct f2fs_sb_info *sbi)
 	struct sit_info *sit_i;
 	unsigned int sit_segs, start;
 	char *src_bitmap, *dst_bitmap;
-	unsigned int bitmap_size;
+	unsigned int bitmap_size, maps_per_seg;
+	unsigned char *bitmap;
 
 	/* allocate memory for SIT information */
 	sit_i = kzalloc(sizeof(struct sit_info), GFP_KERNEL);
@@ -2311,23 +2897,38 @@ static int build_sit_info(struct f2fs_sb_info *sbi)
 	if (!sit_i->dirty_sentries_bitmap)
 		return -ENOMEM;
 
+	/*
+	 * Carve the per-segment bitmaps out of one arena rather than making
+	 * a tiny allocation for each. The maps of a segment sit next to each
+	 * other, since update_sit_entry() touches them together.
+	 */
+	maps_per_seg = f2fs_discard_en(sbi) ? 3 : 2;
+	sit_i->bitmap = f2fs_kvzalloc(MAIN_SEGS(sbi) * maps_per_seg *
+					SIT_VBLOCK_MAP_SIZE, GFP_KERNEL);
+	if (!sit_i->bitmap)
+		return -ENOMEM;
+
+	bitmap = sit_i->bitmap;
 	for (start = 0; start < MAIN_SEGS(sbi); start++) {
-		sit_i->sentries[start].cur_valid_map
-			= kzalloc(SIT_VBLOCK_MAP_SIZE, GFP_KERNEL);
-		sit_i->sentries[start].ckpt_valid_map
-			= kzalloc(SIT_VBLOCK_MAP_SIZE, GFP_KERNEL);
-		if (!sit_i->sentries[start].cur_valid_map ||
-				!sit_i->sentries[start].ckpt_valid_map)
-			return -ENOMEM;
+		sit_i->sentries[start].cur_valid_map = bitmap;
+		bitmap += SIT_VBLOCK_MAP_SIZE;
+
+		sit_i->sentries[start].ckpt_valid_map = bitmap;
+		bitmap += SIT_VBLOCK_MAP_SIZE;
 
 		if (f2fs_discard_en(sbi)) {
-			sit_i->sentries[start].discard_map
-				= kzalloc(SIT_VBLOCK_MAP_SIZE, GFP_KERNEL);
-			if (!sit_i->sentries[start].discard_map)
-				return -ENOMEM;
+			sit_i->sentries[start].discard_map = bitmap;
+			bitmap += SIT_VBLOCK_MAP_SIZE;
 		}
 	}
 
+	if (test_opt(sbi, LAZY_SIT)) {
+		sit_i->lazy_segmap = f2fs_kvzalloc(
+				f2fs_bitmap_size(MAIN_SEGS(sbi)), GFP_KERNEL);
+		if (!sit_i->lazy_segmap)
+			return -ENOMEM;
+	}
+
 	sit_i->tmp_map = kzalloc(SIT_VBLOCK_MAP_SIZE, GFP_KERNEL);
 	if (!sit_i->tmp_map)
 		return -ENOMEM;
@@ -2339,6 +2940,11 @@ static int build_sit_info(struct f2fs_sb_info *sbi)
 			return -ENOMEM;
 	}
 
+	sit_i->sit_heat = f2fs_kvzalloc(SIT_BLK_CNT(sbi) *
+			sizeof(struct f2fs_journal_heat), GFP_KERNEL);
+	if (!sit_i->sit_heat)
+		return -ENOMEM;
+
 	/* get information related with SIT */
 	sit_segs = le32_to_cpu(raw_super->segment_count_sit) >> 1;
 
@@ -2388,6 +2994,10 @@ static int build_free_segmap(struct f2fs_sb_info *sbi)
 	if (!free_i->free_secmap)
 		return -ENOMEM;
 
+	free_i->trimmed_secmap = f2fs_kvzalloc(sec_bitmap_size, GFP_KERNEL);
+	if (!free_i->trimmed_secmap)
+		return -ENOMEM;
+
 	/* set all segments as dirty temporarily */
 	memset(free_i->free_segmap, 0xff, bitmap_size);
 	memset(free_i->free_secmap, 0xff, sec_bitmap_size);
@@ -2427,51 +3037,119 @@ static int build_curseg(struct f2fs_sb_info *sbi)
 	return restore_curseg_summaries(sbi);
 }
 
-static void build_sit_entries(struct f2fs_sb_info *sbi)
+struct sit_load_work {
+	struct work_struct work;
+	struct f2fs_sb_info *sbi;
+	unsigned int start_blk;		/* first SIT block to load */
+	unsigned int nr_blks;		/* # of SIT blocks to load */
+	block_t discard_blks;		/* # of discardable blocks found */
+};
+
+/*
+ * Decode a range of SIT blocks, taking each SIT page once for all the
+ * entries it holds. Ranges are disjoint, so nothing shared is touched here.
+ */
+static void __load_sit_blocks(struct sit_load_work *slw)
 {
+	struct f2fs_sb_info *sbi = slw->sbi;
 	struct sit_info *sit_i = SIT_I(sbi);
-	struct curseg_info *curseg = CURSEG_I(sbi, CURSEG_COLD_DATA);
-	struct f2fs_journal *journal = curseg->journal;
-	struct seg_entry *se;
-	struct f2fs_sit_entry sit;
-	int sit_blk_cnt = SIT_BLK_CNT(sbi);
-	unsigned int i, start, end;
-	unsigned int readed, start_blk = 0;
+	unsigned int blk, end_blk = slw->start_blk + slw->nr_blks;
 
-	do {
-		readed = ra_meta_pages(sbi, start_blk, BIO_MAX_PAGES,
-							META_SIT, true);
+	ra_meta_pages(sbi, slw->start_blk, slw->nr_blks, META_SIT, true);
 
-		start = start_blk * sit_i->sents_per_block;
-		end = (start_blk + readed) * sit_i->sents_per_block;
-
-		for (; start < end && start < MAIN_SEGS(sbi); start++) {
-			struct f2fs_sit_block *sit_blk;
-			struct page *page;
-
-			se = &sit_i->sentries[start];
-			page = get_current_sit_page(sbi, start);
-			sit_blk = (struct f2fs_sit_block *)page_address(page);
-			sit = sit_blk->entries[SIT_ENTRY_OFFSET(sit_i, start)];
-			f2fs_put_page(page, 1);
+	for (blk = slw->start_blk; blk < end_blk; blk++) {
+		unsigned int start = blk * sit_i->sents_per_block;
+		unsigned int end = start + sit_i->sents_per_block;
+		struct f2fs_sit_block *sit_blk;
+		struct page *page;
+		unsigned int segno;
 
-			check_block_count(sbi, start, &sit);
-			seg_info_from_raw_sit(se, &sit);
+		if (start >= MAIN_SEGS(sbi))
+			break;
+		if (end > MAIN_SEGS(sbi))
+			end = MAIN_SEGS(sbi);
+
+		page = get_current_sit_page(sbi, start);
+		sit_blk = (struct f2fs_sit_block *)page_address(page);
+
+		for (segno = start; segno < end; segno++) {
+			struct seg_entry *se = &sit_i->sentries[segno];
+			struct f2fs_sit_entry *sit;
+
+			sit = &sit_blk->entries[SIT_ENTRY_OFFSET(sit_i, segno)];
+			check_block_count(sbi, segno, sit);
+
+			/*
+			 * Empty and full segments have trivial bitmaps, so
+			 * only partially valid ones are left to load later.
+			 */
+			if (sit_i->lazy_segmap && GET_SIT_VBLOCKS(sit) &&
+				GET_SIT_VBLOCKS(sit) < sbi->blocks_per_seg) {
+				seg_counts_from_raw_sit(se, sit);
+				set_bit(segno, sit_i->lazy_segmap);
+			} else {
+				seg_info_from_raw_sit(se, sit);
+				if (f2fs_discard_en(sbi))
+					memcpy(se->discard_map,
+						se->cur_valid_map,
+						SIT_VBLOCK_MAP_SIZE);
+			}
 
 			/* build discard map only one time */
-			if (f2fs_discard_en(sbi)) {
-				memcpy(se->discard_map, se->cur_valid_map,
-							SIT_VBLOCK_MAP_SIZE);
-				sbi->discard_blks += sbi->blocks_per_seg -
+			if (f2fs_discard_en(sbi))
+				slw->discard_blks += sbi->blocks_per_seg -
 							se->valid_blocks;
-			}
+		}
+		f2fs_put_page(page, 1);
+	}
+}
 
-			if (sbi->segs_per_sec > 1)
-				get_sec_entry(sbi, start)->valid_blocks +=
-							se->valid_blocks;
+static void sit_load_work_func(struct work_struct *work)
+{
+	__load_sit_blocks(container_of(work, struct sit_load_work, work));
+}
+
+static void build_sit_entries(struct f2fs_sb_info *sbi)
+{
+	struct sit_info *sit_i = SIT_I(sbi);
+	struct curseg_info *curseg = CURSEG_I(sbi, CURSEG_COLD_DATA);
+	struct f2fs_journal *journal = curseg->journal;
+	struct seg_entry *se;
+	struct f2fs_sit_entry sit;
+	int sit_blk_cnt = SIT_BLK_CNT(sbi);
+	unsigned int nr_works = DIV_ROUND_UP(sit_blk_cnt, SIT_LOAD_BLOCKS);
+	struct sit_load_work *works = NULL;
+	unsigned int i, start;
+
+	if (nr_works > 1)
+		works = f2fs_kvzalloc(nr_works * sizeof(struct sit_load_work),
+								GFP_KERNEL);
+	if (works) {
+		/* decode disjoint ranges of SIT blocks in parallel */
+		for (i = 0; i < nr_works; i++) {
+			INIT_WORK(&works[i].work, sit_load_work_func);
+			works[i].sbi = sbi;
+			works[i].start_blk = i * SIT_LOAD_BLOCKS;
+			works[i].nr_blks = min_t(unsigned int, SIT_LOAD_BLOCKS,
+					sit_blk_cnt - works[i].start_blk);
+			queue_work(system_unbound_wq, &works[i].work);
+		}
+		for (i = 0; i < nr_works; i++) {
+			flush_work(&works[i].work);
+			sbi->discard_blks += works[i].discard_blks;
 		}
-		start_blk += readed;
-	} while (start_blk < sit_blk_cnt);
+		kvfree(works);
+	} else {
+		struct sit_load_work slw = { .sbi = sbi, };
+
+		for (i = 0; i < nr_works; i++) {
+			slw.start_blk = i * SIT_LOAD_BLOCKS;
+			slw.nr_blks = min_t(unsigned int, SIT_LOAD_BLOCKS,
+					sit_blk_cnt - slw.start_blk);
+			__load_sit_blocks(&slw);
+		}
+		sbi->discard_blks += slw.discard_blks;
+	}
 
 	down_read(&curseg->journal_rwsem);
 	for (i = 0; i < sits_in_cursum(journal); i++) {
@@ -2485,6 +3163,8 @@ static void build_sit_entries(struct f2fs_sb_info *sbi)
 
 		check_block_count(sbi, start, &sit);
 		seg_info_from_raw_sit(se, &sit);
+		if (sit_i->lazy_segmap)
+			clear_bit(start, sit_i->lazy_segmap);
 
 		if (f2fs_discard_en(sbi)) {
 			memcpy(se->discard_map, se->cur_valid_map,
@@ -2492,14 +3172,262 @@ static void build_sit_entries(struct f2fs_sb_info *sbi)
 			sbi->discard_blks += old_valid_blocks -
 						se->valid_blocks;
 		}
-
-		if (sbi->segs_per_sec > 1)
-			get_sec_entry(sbi, start)->valid_blocks +=
-				se->valid_blocks - old_valid_blocks;
 	}
 	up_read(&curseg->journal_rwsem);
 }
 
+/* section counters span SIT blocks, so sum them up once all are in */
+static void init_sec_entries(struct f2fs_sb_info *sbi)
+{
+	unsigned int segno;
+
+	if (sbi->segs_per_sec == 1)
+		return;
+
+	for (segno = 0; segno < MAIN_SEGS(sbi); segno++)
+		get_sec_entry(sbi, segno)->valid_blocks +=
+				get_seg_entry(sbi, segno)->valid_blocks;
+}
+
+static int sit_load_thread(void *data)
+{
+	struct f2fs_sb_info *sbi = data;
+	struct sit_info *sit_i = SIT_I(sbi);
+	unsigned int segno = 0, end;
+
+	while (!kthread_should_stop()) {
+		segno = find_next_bit(sit_i->lazy_segmap,
+						MAIN_SEGS(sbi), segno);
+		if (segno >= MAIN_SEGS(sbi))
+			break;
+
+		/* leave the device to user I/O, the rest loads on demand */
+		if (!is_idle(sbi)) {
+			schedule_timeout_interruptible(
+				msecs_to_jiffies(DEF_LAZY_SIT_BUSY_TIME));
+			continue;
+		}
+
+		end = min_t(unsigned int, MAIN_SEGS(sbi),
+			rounddown(segno, sit_i->sents_per_block) +
+					sit_i->sents_per_block);
+
+		mutex_lock(&sit_i->sentry_lock);
+		__load_lazy_entries(sbi, segno, end);
+		mutex_unlock(&sit_i->sentry_lock);
+
+		segno = end;
+		cond_resched();
+	}
+
+	/* all loaded; wait to be reaped by stop_sit_load_thread() */
+	set_current_state(TASK_INTERRUPTIBLE);
+	while (!kthread_should_stop()) {
+		schedule();
+		set_current_state(TASK_INTERRUPTIBLE);
+	}
+	__set_current_state(TASK_RUNNING);
+	return 0;
+}
+
+static int start_sit_load_thread(struct f2fs_sb_info *sbi)
+{
+	dev_t dev = sbi->sb->s_bdev->bd_dev;
+	struct sit_info *sit_i = SIT_I(sbi);
+	int err = 0;
+
+	if (!sit_i->lazy_segmap)
+		return 0;
+
+	sit_i->sit_load_task = kthread_run(sit_load_thread, sbi,
+				"f2fs_sit-%u:%u", MAJOR(dev), MINOR(dev));
+	if (IS_ERR(sit_i->sit_load_task)) {
+		err = PTR_ERR(sit_i->sit_load_task);
+		sit_i->sit_load_task = NULL;
+	}
+	return err;
+}
+
+static void stop_sit_load_thread(struct f2fs_sb_info *sbi)
+{
+	struct sit_info *sit_i = SIT_I(sbi);
+
+	if (!sit_i || !sit_i->sit_load_task)
+		return;
+	kthread_stop(sit_i->sit_load_task);
+	sit_i->sit_load_task = NULL;
+}
+
+/* convert a bitmap to or from the little-endian layout used on disk */
+static void __copy_bitmap_le(unsigned long *dst, const unsigned long *src,
+							unsigned int nbits)
+{
+	unsigned int i;
+
+	for (i = 0; i < BITS_TO_LONGS(nbits); i++) {
+#if BITS_PER_LONG == 64
+		dst[i] = (__force unsigned long)cpu_to_le64(src[i]);
+#else
+		dst[i] = (__force unsigned long)cpu_to_le32(src[i]);
+#endif
+	}
+}
+
+void write_seg_summary(struct f2fs_sb_info *sbi, block_t start_blk,
+							__u64 cp_ver)
+{
+	struct free_segmap_info *free_i = FREE_I(sbi);
+	struct dirty_seglist_info *dirty_i = DIRTY_I(sbi);
+	unsigned int map_size = SEG_SUMMARY_MAP_SIZE(MAIN_SEGS(sbi));
+	unsigned int nblocks = seg_summary_blocks(sbi);
+	struct seg_summary_head *head;
+	char *buf, *ptr;
+	unsigned int i;
+
+	/* without it, the next mount just rebuilds the maps */
+	buf = f2fs_kvzalloc(nblocks * F2FS_BLKSIZE, GFP_NOFS);
+	if (!buf)
+		return;
+
+	head = (struct seg_summary_head *)buf;
+	ptr = buf + sizeof(struct seg_summary_head);
+
+	/*
+	 * Prefree segments are freed once this checkpoint is committed, so
+	 * save them as free, which is also what a rebuild would find.
+	 */
+	mutex_lock(&dirty_i->seglist_lock);
+	spin_lock(&free_i->segmap_lock);
+	bitmap_andnot((unsigned long *)ptr, free_i->free_segmap,
+			dirty_i->dirty_segmap[PRE], MAIN_SEGS(sbi));
+	spin_unlock(&free_i->segmap_lock);
+	__copy_bitmap_le((unsigned long *)ptr, (unsigned long *)ptr,
+							MAIN_SEGS(sbi));
+	ptr += map_size;
+
+	__copy_bitmap_le((unsigned long *)ptr, dirty_i->dirty_segmap[DIRTY],
+							MAIN_SEGS(sbi));
+	mutex_unlock(&dirty_i->seglist_lock);
+	ptr += map_size;
+
+	if (sbi->segs_per_sec > 1) {
+		__le32 *sec_blocks = (__le32 *)ptr;
+
+		for (i = 0; i < MAIN_SECS(sbi); i++)
+			sec_blocks[i] = cpu_to_le32(
+				SIT_I(sbi)->sec_entries[i].valid_blocks);
+	}
+
+	head->cp_ver = cpu_to_le64(cp_ver);
+	head->valid_blocks = cpu_to_le32(SIT_I(sbi)->written_valid_blocks);
+	head->checksum = cpu_to_le32(f2fs_crc32(sbi,
+			buf + sizeof(struct seg_summary_head),
+			seg_summary_size(sbi) - sizeof(struct seg_summary_head)));
+
+	for (i = 0; i < nblocks; i++)
+		update_meta_page(sbi, buf + i * F2FS_BLKSIZE, start_blk + i);
+
+	kvfree(buf);
+}
+
+/*
+ * Return the segment summary saved with the current checkpoint, or NULL if
+ * there is none that can be trusted.
+ */
+static void *read_seg_summary(struct f2fs_sb_info *sbi)
+{
+	struct f2fs_checkpoint *ckpt = F2FS_CKPT(sbi);
+	unsigned int nblocks = seg_summary_blocks(sbi);
+	struct seg_summary_head *head;
+	block_t start_blk;
+	__u64 cp_ver;
+	char *buf;
+	unsigned int i;
+
+	if (!is_set_ckpt_flags(sbi, CP_UMOUNT_FLAG) || !seg_summary_fits(sbi))
+		return NULL;
+
+	buf = f2fs_kvzalloc(nblocks * F2FS_BLKSIZE, GFP_KERNEL);
+	if (!buf)
+		return NULL;
+
+	start_blk = __start_cp_addr(sbi) + sbi->blocks_per_seg - nblocks;
+	ra_meta_pages(sbi, start_blk, nblocks, META_CP, true);
+
+	for (i = 0; i < nblocks; i++) {
+		struct page *page = get_meta_page(sbi, start_blk + i);
+
+		memcpy(buf + i * F2FS_BLKSIZE, page_address(page),
+							F2FS_BLKSIZE);
+		f2fs_put_page(page, 1);
+	}
+
+	head = (struct seg_summary_head *)buf;
+	cp_ver = cur_cp_version(ckpt) | (cur_cp_crc(ckpt) << 32);
+
+	if (le64_to_cpu(head->cp_ver) != cp_ver ||
+		le32_to_cpu(head->checksum) != f2fs_crc32(sbi,
+			buf + sizeof(struct seg_summary_head),
+			seg_summary_size(sbi) -
+				sizeof(struct seg_summary_head))) {
+		kvfree(buf);
+		return NULL;
+	}
+	return buf;
+}
+
+static void restore_seg_summary(struct f2fs_sb_info *sbi, void *sum)
+{
+	struct free_segmap_info *free_i = FREE_I(sbi);
+	struct dirty_seglist_info *dirty_i = DIRTY_I(sbi);
+	struct seg_summary_head *head = sum;
+	unsigned int map_size = SEG_SUMMARY_MAP_SIZE(MAIN_SEGS(sbi));
+	unsigned long *dirty_map;
+	unsigned int secno, segno;
+	char *ptr = sum + sizeof(struct seg_summary_head);
+	int type;
+
+	/* free segmap */
+	__copy_bitmap_le(free_i->free_segmap, (unsigned long *)ptr,
+							MAIN_SEGS(sbi));
+	free_i->free_segments = MAIN_SEGS(sbi) -
+			bitmap_weight(free_i->free_segmap, MAIN_SEGS(sbi));
+
+	for (secno = 0; secno < MAIN_SECS(sbi); secno++) {
+		unsigned int start = secno * sbi->segs_per_sec;
+		unsigned int end = start + sbi->segs_per_sec;
+
+		if (find_next_bit(free_i->free_segmap, end, start) < end)
+			continue;
+		clear_bit(secno, free_i->free_secmap);
+		free_i->free_sections++;
+	}
+	SIT_I(sbi)->written_valid_blocks = le32_to_cpu(head->valid_blocks);
+
+	for (type = CURSEG_HOT_DATA; type <= CURSEG_COLD_NODE; type++)
+		__set_test_and_inuse(sbi, CURSEG_I(sbi, type)->segno);
+	ptr += map_size;
+
+	/* dirty segmap, converted in place */
+	dirty_map = (unsigned long *)ptr;
+	__copy_bitmap_le(dirty_map, dirty_map, MAIN_SEGS(sbi));
+
+	mutex_lock(&dirty_i->seglist_lock);
+	for_each_set_bit(segno, dirty_map, MAIN_SEGS(sbi))
+		__locate_dirty_segment(sbi, segno, DIRTY);
+	mutex_unlock(&dirty_i->seglist_lock);
+	ptr += map_size;
+
+	/* section valid blocks */
+	if (sbi->segs_per_sec > 1) {
+		__le32 *sec_blocks = (__le32 *)ptr;
+
+		for (secno = 0; secno < MAIN_SECS(sbi); secno++)
+			SIT_I(sbi)->sec_entries[secno].valid_blocks =
+					le32_to_cpu(sec_blocks[secno]);
+	}
+}
+
 static void init_free_segmap(struct f2fs_sb_info *sbi)
 {
 	unsigned int start;
@@ -2558,10 +3486,26 @@ static int init_victim_secmap(struct f2fs_sb_info *sbi)
 	return 0;
 }
 
+static int init_dirty_segs_in_sec(struct f2fs_sb_info *sbi)
+{
+	struct dirty_seglist_info *dirty_i = DIRTY_I(sbi);
+
+	/* victim search counts per-segment bits when a section is a segment */
+	if (sbi->segs_per_sec == 1)
+		return 0;
+
+	dirty_i->dirty_segs_in_sec = f2fs_kvzalloc(MAIN_SECS(sbi) *
+					sizeof(unsigned int), GFP_KERNEL);
+	if (!dirty_i->dirty_segs_in_sec)
+		return -ENOMEM;
+	return 0;
+}
+
 static int build_dirty_segmap(struct f2fs_sb_info *sbi)
 {
 	struct dirty_seglist_info *dirty_i;
 	unsigned int bitmap_size, i;
+	int err;
 
 	/* allocate memory for dirty segments list information */
 	dirty_i = kzalloc(sizeof(struct dirty_seglist_info), GFP_KERNEL);
@@ -2579,7 +3523,10 @@ static int build_dirty_segmap(struct f2fs_sb_info *sbi)
 			return -ENOMEM;
 	}
 
-	init_dirty_segmap(sbi);
+	err = init_dirty_segs_in_sec(sbi);
+	if (err)
+		return err;
+
 	return init_victim_secmap(sbi);
 }
 
@@ -2616,6 +3563,7 @@ int build_segment_manager(struct f2fs_sb_info *sbi)
 	struct f2fs_super_block *raw_super = F2FS_RAW_SUPER(sbi);
 	struct f2fs_checkpoint *ckpt = F2FS_CKPT(sbi);
 	struct f2fs_sm_info *sm_info;
+	void *sum;
 	int err;
 
 	sm_info = kzalloc(sizeof(struct f2fs_sm_info), GFP_KERNEL);
@@ -2642,7 +3590,6 @@ int build_segment_manager(struct f2fs_sb_info *sbi)
 	sm_info->min_fsync_blocks = DEF_MIN_FSYNC_BLOCKS;
 
 	INIT_LIST_HEAD(&sm_info->discard_list);
-	INIT_LIST_HEAD(&sm_info->wait_list);
 	sm_info->nr_discards = 0;
 	sm_info->max_discards = 0;
 
@@ -2656,6 +3603,10 @@ int build_segment_manager(struct f2fs_sb_info *sbi)
 			return err;
 	}
 
+	err = create_discard_cmd_control(sbi);
+	if (err)
+		return err;
+
 	err = build_sit_info(sbi);
 	if (err)
 		return err;
@@ -2666,16 +3617,29 @@ int build_segment_manager(struct f2fs_sb_info *sbi)
 	if (err)
 		return err;
 
+	sum = read_seg_summary(sbi);
+
 	/* reinit free segmap based on SIT */
 	build_sit_entries(sbi);
 
-	init_free_segmap(sbi);
 	err = build_dirty_segmap(sbi);
-	if (err)
+	if (err) {
+		kvfree(sum);
 		return err;
+	}
+
+	if (sum) {
+		restore_seg_summary(sbi, sum);
+		kvfree(sum);
+	} else {
+		init_sec_entries(sbi);
+		init_free_segmap(sbi);
+		init_dirty_segmap(sbi);
+	}
 
 	init_min_max_mtime(sbi);
-	return 0;
+
+	return start_sit_load_thread(sbi);
 }
 
 static void discard_dirty_segmap(struct f2fs_sb_info *sbi,
@@ -2708,6 +3672,7 @@ static void destroy_dirty_segmap(struct f2fs_sb_info *sbi)
 		discard_dirty_segmap(sbi, i);
 
 	destroy_victim_secmap(sbi);
+	kvfree(dirty_i->dirty_segs_in_sec);
 	SM_I(sbi)->dirty_info = NULL;
 	kfree(dirty_i);
 }
@@ -2735,28 +3700,24 @@ static void destroy_free_segmap(struct f2fs_sb_info *sbi)
 	SM_I(sbi)->free_info = NULL;
 	kvfree(free_i->free_segmap);
 	kvfree(free_i->free_secmap);
+	kvfree(free_i->trimmed_secmap);
 	kfree(free_i);
 }
 
 static void destroy_sit_info(struct f2fs_sb_info *sbi)
 {
 	struct sit_info *sit_i = SIT_I(sbi);
-	unsigned int start;
 
 	if (!sit_i)
 		return;
 
-	if (sit_i->sentries) {
-		for (start = 0; start < MAIN_SEGS(sbi); start++) {
-			kfree(sit_i->sentries[start].cur_valid_map);
-			kfree(sit_i->sentries[start].ckpt_valid_map);
-			kfree(sit_i->sentries[start].discard_map);
-		}
-	}
+	kvfree(sit_i->bitmap);
+	kvfree(sit_i->lazy_segmap);
 	kfree(sit_i->tmp_map);
 
 	kvfree(sit_i->sentries);
 	kvfree(sit_i->sec_entries);
+	kvfree(sit_i->sit_heat);
 	kvfree(sit_i->dirty_sentries_bitmap);
 
 	SM_I(sbi)->sit_info = NULL;
@@ -2770,7 +3731,9 @@ void destroy_segment_manager(struct f2fs_sb_info *sbi)
 
 	if (!sm_info)
 		return;
+	stop_sit_load_thread(sbi);
 	destroy_flush_cmd_control(sbi, true);
+	destroy_discard_cmd_control(sbi);
 	destroy_dirty_segmap(sbi);
 	destroy_curseg(sbi);
 	destroy_free_segmap(sbi);
@@ -2786,15 +3749,15 @@ int __init create_segment_manager_caches(void)
 	if (!discard_entry_slab)
 		goto fail;
 
-	bio_entry_slab = f2fs_kmem_cache_create("bio_entry",
-			sizeof(struct bio_entry));
-	if (!bio_entry_slab)
+	discard_cmd_slab = f2fs_kmem_cache_create("discard_cmd",
+			sizeof(struct discard_cmd));
+	if (!discard_cmd_slab)
 		goto destroy_discard_entry;
 
 	sit_entry_set_slab = f2fs_kmem_cache_create("sit_entry_set",
 			sizeof(struct sit_entry_set));
 	if (!sit_entry_set_slab)
-		goto destroy_bio_entry;
+		goto destroy_discard_cmd;
 
 	inmem_entry_slab = f2fs_kmem_cache_create("inmem_page_entry",
 			sizeof(struct inmem_pages));
@@ -2804,8 +3767,8 @@ int __init create_segment_manager_caches(void)
 
 destroy_sit_entry_set:
 	kmem_cache_destroy(sit_entry_set_slab);
-destroy_bio_entry:
-	kmem_cache_destroy(bio_entry_slab);
+destroy_discard_cmd:
+	kmem_cache_destroy(discard_cmd_slab);
 destroy_discard_entry:
 	kmem_cache_destroy(discard_entry_slab);
 fail:
@@ -2815,7 +3778,7 @@ fail:
 void destroy_segment_manager_caches(void)
 {
 	kmem_cache_destroy(sit_entry_set_slab);
-	kmem_cache_destroy(bio_entry_slab);
+	kmem_cache_destroy(discard_cmd_slab);
 	kmem_cache_destroy(discard_entry_slab);
 	kmem_cache_destroy(inmem_entry_slab);
 }
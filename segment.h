@@ -15,6 +15,16 @@
 #define NULL_SEGNO			((unsigned int)(~0))
 #define NULL_SECNO			((unsigned int)(~0))
 
+/* # of free sections a log looks up at once when it needs a new one */
+#define SEC_POOL_SIZE			8
+/* # of sections ahead of a log searched for already trimmed ones */
+#define SEC_TRIM_WINDOW			(SEC_POOL_SIZE * 8)
+
+/* # of SIT blocks decoded by one mount-time worker */
+#define SIT_LOAD_BLOCKS			BIO_MAX_PAGES
+/* ms the lazy SIT loader backs off while the device is busy */
+#define DEF_LAZY_SIT_BUSY_TIME		100
+
 #define DEF_RECLAIM_PREFREE_SEGMENTS	5	/* 5% over total segments */
 #define DEF_MAX_RECLAIM_PREFREE_SEGMENTS	4096	/* 8GB in maximum */
 
@@ -205,6 +215,9 @@ struct sit_info {
 	char *sit_bitmap;		/* SIT bitmap pointer */
 	unsigned int bitmap_size;	/* SIT bitmap size */
 
+	unsigned char *bitmap;			/* arena of seg_entry bitmaps */
+	unsigned long *lazy_segmap;		/* bitmaps not loaded yet */
+	struct task_struct *sit_load_task;	/* loads lazy bitmaps */
 	unsigned long *tmp_map;			/* bitmap for temporal use */
 	unsigned long *dirty_sentries_bitmap;	/* bitmap for dirty sentries */
 	unsigned int dirty_sentries;		/* # of dirty sentries */
@@ -212,6 +225,7 @@ struct sit_info {
 	struct mutex sentry_lock;		/* to protect SIT cache */
 	struct seg_entry *sentries;		/* SIT segment-level cache */
 	struct sec_entry *sec_entries;		/* SIT section-level cache */
+	struct f2fs_journal_heat *sit_heat;	/* SIT block update history */
 
 	/* for cost-benefit algorithm in cleaning procedure */
 	unsigned long long elapsed_time;	/* elapsed time after mount */
@@ -227,6 +241,7 @@ struct free_segmap_info {
 	spinlock_t segmap_lock;		/* free segmap lock */
 	unsigned long *free_segmap;	/* free segment bitmap */
 	unsigned long *free_secmap;	/* free section bitmap */
+	unsigned long *trimmed_secmap;	/* free sections already discarded */
 };
 
 /* Notice: The order of dirty type is same with CURSEG_XXX in f2fs.h */
@@ -248,12 +263,13 @@ struct dirty_seglist_info {
 	struct mutex seglist_lock;		/* lock for segment bitmaps */
 	int nr_dirty[NR_DIRTY_TYPE];		/* # of dirty segments */
 	unsigned long *victim_secmap;		/* background GC victims */
+	unsigned int *dirty_segs_in_sec;	/* # of DIRTY segs per section */
 };
 
 /* victim selection function for cleaning and SSR */
 struct victim_selection {
 	int (*get_victim)(struct f2fs_sb_info *, unsigned int *,
-							int, int, char);
+							int, int, char, int);
 };
 
 /* for active log information */
@@ -267,12 +283,18 @@ struct curseg_info {
 	unsigned short next_blkoff;		/* next block offset to write */
 	unsigned int zone;			/* current zone number */
 	unsigned int next_segno;		/* preallocated segment */
+	unsigned int sec_pool[SEC_POOL_SIZE];	/* free sections found ahead */
+	unsigned int sec_pool_pos;		/* next entry in sec_pool */
+	unsigned int sec_pool_cnt;		/* # of entries in sec_pool */
 };
 
 struct sit_entry_set {
 	struct list_head set_list;	/* link with all sit sets */
 	unsigned int start_segno;	/* start segno of sits in set */
 	unsigned int entry_cnt;		/* the # of sit entries in set */
+	unsigned int heat;		/* update frequency of the SIT block */
+	struct page *page;		/* next sit block being filled */
+	DECLARE_BITMAP(entry_map, SIT_ENTRY_PER_BLOCK);	/* entries in page */
 };
 
 /*
@@ -310,17 +332,59 @@ static inline unsigned int get_valid_blocks(struct f2fs_sb_info *sbi,
 		return get_seg_entry(sbi, segno)->valid_blocks;
 }
 
-static inline void seg_info_from_raw_sit(struct seg_entry *se,
+/*
+ * On a clean umount, the free and dirty segment maps and the section valid
+ * block counts are saved in the unused tail of the CP segment. The next mount
+ * then restores them rather than rebuilding them from every seg_entry.
+ * They are only trusted along with the checkpoint they were written with.
+ */
+struct seg_summary_head {
+	__le64 cp_ver;			/* cp version | cp crc << 32 */
+	__le32 checksum;		/* crc32 of what follows the head */
+	__le32 valid_blocks;		/* written_valid_blocks */
+} __packed;
+
+#define SEG_SUMMARY_MAP_SIZE(nr)	(round_up(nr, 64) >> 3)
+
+static inline unsigned int seg_summary_size(struct f2fs_sb_info *sbi)
+{
+	unsigned int size = sizeof(struct seg_summary_head) +
+				2 * SEG_SUMMARY_MAP_SIZE(MAIN_SEGS(sbi));
+
+	if (sbi->segs_per_sec > 1)
+		size += MAIN_SECS(sbi) * sizeof(__le32);
+	return size;
+}
+
+static inline unsigned int seg_summary_blocks(struct f2fs_sb_info *sbi)
+{
+	return DIV_ROUND_UP(seg_summary_size(sbi), F2FS_BLKSIZE);
+}
+
+/* the summary has to fit between the CP pack and the end of its segment */
+static inline bool seg_summary_fits(struct f2fs_sb_info *sbi)
+{
+	return le32_to_cpu(F2FS_CKPT(sbi)->cp_pack_total_block_count) +
+			seg_summary_blocks(sbi) <= sbi->blocks_per_seg;
+}
+
+static inline void seg_counts_from_raw_sit(struct seg_entry *se,
 					struct f2fs_sit_entry *rs)
 {
 	se->valid_blocks = GET_SIT_VBLOCKS(rs);
 	se->ckpt_valid_blocks = GET_SIT_VBLOCKS(rs);
-	memcpy(se->cur_valid_map, rs->valid_map, SIT_VBLOCK_MAP_SIZE);
-	memcpy(se->ckpt_valid_map, rs->valid_map, SIT_VBLOCK_MAP_SIZE);
 	se->type = GET_SIT_TYPE(rs);
 	se->mtime = le64_to_cpu(rs->mtime);
 }
 
+static inline void seg_info_from_raw_sit(struct seg_entry *se,
+					struct f2fs_sit_entry *rs)
+{
+	seg_counts_from_raw_sit(se, rs);
+	memcpy(se->cur_valid_map, rs->valid_map, SIT_VBLOCK_MAP_SIZE);
+	memcpy(se->ckpt_valid_map, rs->valid_map, SIT_VBLOCK_MAP_SIZE);
+}
+
 static inline void seg_info_to_raw_sit(struct seg_entry *se,
 					struct f2fs_sit_entry *rs)
 {
@@ -358,6 +422,7 @@ static inline void __set_free(struct f2fs_sb_info *sbi, unsigned int segno)
 			start_segno + sbi->segs_per_sec, start_segno);
 	if (next >= start_segno + sbi->segs_per_sec) {
 		clear_bit(secno, free_i->free_secmap);
+		clear_bit(secno, free_i->trimmed_secmap);
 		free_i->free_sections++;
 	}
 	spin_unlock(&free_i->segmap_lock);
@@ -389,8 +454,10 @@ static inline void __set_test_and_free(struct f2fs_sb_info *sbi,
 		next = find_next_bit(free_i->free_segmap,
 				start_segno + sbi->segs_per_sec, start_segno);
 		if (next >= start_segno + sbi->segs_per_sec) {
-			if (test_and_clear_bit(secno, free_i->free_secmap))
+			if (test_and_clear_bit(secno, free_i->free_secmap)) {
+				clear_bit(secno, free_i->trimmed_secmap);
 				free_i->free_sections++;
+			}
 		}
 	}
 	spin_unlock(&free_i->segmap_lock);
@@ -21,9 +21,12 @@ static unsigned int shrinker_run_no;
 
 static unsigned long __count_nat_entries(struct f2fs_sb_info *sbi)
 {
-	long count = NM_I(sbi)->nat_cnt - NM_I(sbi)->dirty_nat_cnt;
+	long count = nat_cache_count(NM_I(sbi)) -
+				dirty_nat_count(NM_I(sbi));
 
-	return count > 0 ? count : 0;
+	if (count < 0)
+		count = 0;
+	return count + nat_block_count(NM_I(sbi)) * NAT_ENTRY_PER_BLOCK;
 }
 
 static unsigned long __count_free_nids(struct f2fs_sb_info *sbi)
@@ -107,6 +107,8 @@ enum {
 	Opt_mode,
 	Opt_fault_injection,
 	Opt_lazytime,
+	Opt_lazy_sit,
+	Opt_snapshot_cp,
 	Opt_nolazytime,
 	Opt_err,
 };
@@ -139,6 +141,8 @@ static match_table_t f2fs_tokens = {
 	{Opt_mode, "mode=%s"},
 	{Opt_fault_injection, "fault_injection=%u"},
 	{Opt_lazytime, "lazytime"},
+	{Opt_lazy_sit, "lazy_sit"},
+	{Opt_snapshot_cp, "snapshot_cp"},
 	{Opt_nolazytime, "nolazytime"},
 	{Opt_err, NULL},
 };
@@ -195,6 +199,31 @@ static ssize_t lifetime_write_kbytes_show(struct f2fs_attr *a,
 			BD_PART_WRITTEN(sbi)));
 }
 
+static ssize_t gc_write_rate_show(struct f2fs_attr *a,
+		struct f2fs_sb_info *sbi, char *buf)
+{
+	if (!sbi->gc_thread)
+		return snprintf(buf, PAGE_SIZE, "0\n");
+	return snprintf(buf, PAGE_SIZE, "%u\n", sbi->gc_thread->write_rate);
+}
+
+static ssize_t gc_consume_rate_show(struct f2fs_attr *a,
+		struct f2fs_sb_info *sbi, char *buf)
+{
+	if (!sbi->gc_thread)
+		return snprintf(buf, PAGE_SIZE, "0\n");
+	return snprintf(buf, PAGE_SIZE, "%d\n", sbi->gc_thread->consume_rate);
+}
+
+static ssize_t gc_time_to_full_show(struct f2fs_attr *a,
+		struct f2fs_sb_info *sbi, char *buf)
+{
+	if (!sbi->gc_thread ||
+		sbi->gc_thread->time_to_full == GC_TIME_TO_FULL_INF)
+		return snprintf(buf, PAGE_SIZE, "-1\n");
+	return snprintf(buf, PAGE_SIZE, "%u\n", sbi->gc_thread->time_to_full);
+}
+
 static ssize_t f2fs_sbi_show(struct f2fs_attr *a,
 			struct f2fs_sb_info *sbi, char *buf)
 {
@@ -232,6 +261,9 @@ static ssize_t f2fs_sbi_store(struct f2fs_attr *a,
 	if (a->struct_type == FAULT_INFO_TYPE && t >= (1 << FAULT_MAX))
 		return -EINVAL;
 #endif
+	/* the counter can only be reset */
+	if (!strcmp(a->attr.name, "sync_nid_builds") && t)
+		return -EINVAL;
 	*ui = t;
 	return count;
 }
@@ -284,6 +316,11 @@ F2FS_RW_ATTR(GC_THREAD, f2fs_gc_kthread, gc_min_sleep_time, min_sleep_time);
 F2FS_RW_ATTR(GC_THREAD, f2fs_gc_kthread, gc_max_sleep_time, max_sleep_time);
 F2FS_RW_ATTR(GC_THREAD, f2fs_gc_kthread, gc_no_gc_sleep_time, no_gc_sleep_time);
 F2FS_RW_ATTR(GC_THREAD, f2fs_gc_kthread, gc_idle, gc_idle);
+F2FS_RW_ATTR(GC_THREAD, f2fs_gc_kthread, gc_urgent_sleep_time,
+							urgent_sleep_time);
+F2FS_RW_ATTR(GC_THREAD, f2fs_gc_kthread, gc_lead_time, lead_time);
+F2FS_RW_ATTR(GC_THREAD, f2fs_gc_kthread, gc_busy_write_rate,
+							busy_write_rate);
 F2FS_RW_ATTR(SM_INFO, f2fs_sm_info, reclaim_segments, rec_prefree_segments);
 F2FS_RW_ATTR(SM_INFO, f2fs_sm_info, max_small_discards, max_discards);
 F2FS_RW_ATTR(SM_INFO, f2fs_sm_info, batched_trim_sections, trim_sections);
@@ -293,15 +330,22 @@ F2FS_RW_ATTR(SM_INFO, f2fs_sm_info, min_fsync_blocks, min_fsync_blocks);
 F2FS_RW_ATTR(NM_INFO, f2fs_nm_info, ram_thresh, ram_thresh);
 F2FS_RW_ATTR(NM_INFO, f2fs_nm_info, ra_nid_pages, ra_nid_pages);
 F2FS_RW_ATTR(NM_INFO, f2fs_nm_info, dirty_nats_ratio, dirty_nats_ratio);
+F2FS_RW_ATTR(NM_INFO, f2fs_nm_info, nid_low_wmark, nid_low_wmark);
+F2FS_RW_ATTR(NM_INFO, f2fs_nm_info, nid_high_wmark, nid_high_wmark);
+F2FS_RW_ATTR(NM_INFO, f2fs_nm_info, sync_nid_builds, sync_nid_builds);
 F2FS_RW_ATTR(F2FS_SBI, f2fs_sb_info, max_victim_search, max_victim_search);
 F2FS_RW_ATTR(F2FS_SBI, f2fs_sb_info, dir_level, dir_level);
 F2FS_RW_ATTR(F2FS_SBI, f2fs_sb_info, cp_interval, interval_time[CP_TIME]);
 F2FS_RW_ATTR(F2FS_SBI, f2fs_sb_info, idle_interval, interval_time[REQ_TIME]);
+F2FS_RW_ATTR(F2FS_SBI, f2fs_sb_info, slow_cp_ms, slow_cp_ms);
 #ifdef CONFIG_F2FS_FAULT_INJECTION
 F2FS_RW_ATTR(FAULT_INFO_RATE, f2fs_fault_info, inject_rate, inject_rate);
 F2FS_RW_ATTR(FAULT_INFO_TYPE, f2fs_fault_info, inject_type, inject_type);
 #endif
 F2FS_GENERAL_RO_ATTR(lifetime_write_kbytes);
+F2FS_GENERAL_RO_ATTR(gc_write_rate);
+F2FS_GENERAL_RO_ATTR(gc_consume_rate);
+F2FS_GENERAL_RO_ATTR(gc_time_to_full);
 
 #define ATTR_LIST(name) (&f2fs_attr_##name.attr)
 static struct attribute *f2fs_attrs[] = {
@@ -309,6 +353,9 @@ static struct attribute *f2fs_attrs[] = {
 	ATTR_LIST(gc_max_sleep_time),
 	ATTR_LIST(gc_no_gc_sleep_time),
 	ATTR_LIST(gc_idle),
+	ATTR_LIST(gc_urgent_sleep_time),
+	ATTR_LIST(gc_lead_time),
+	ATTR_LIST(gc_busy_write_rate),
 	ATTR_LIST(reclaim_segments),
 	ATTR_LIST(max_small_discards),
 	ATTR_LIST(batched_trim_sections),
@@ -320,13 +367,20 @@ static struct attribute *f2fs_attrs[] = {
 	ATTR_LIST(ram_thresh),
 	ATTR_LIST(ra_nid_pages),
 	ATTR_LIST(dirty_nats_ratio),
+	ATTR_LIST(nid_low_wmark),
+	ATTR_LIST(nid_high_wmark),
+	ATTR_LIST(sync_nid_builds),
 	ATTR_LIST(cp_interval),
 	ATTR_LIST(idle_interval),
+	ATTR_LIST(slow_cp_ms),
 #ifdef CONFIG_F2FS_FAULT_INJECTION
 	ATTR_LIST(inject_rate),
 	ATTR_LIST(inject_type),
 #endif
 	ATTR_LIST(lifetime_write_kbytes),
+	ATTR_LIST(gc_write_rate),
+	ATTR_LIST(gc_consume_rate),
+	ATTR_LIST(gc_time_to_full),
 	NULL,
 };
 
@@ -555,6 +609,12 @@ static int parse_options(struct super_block *sb, char *options)
 		case Opt_nolazytime:
 			sb->s_flags &= ~MS_LAZYTIME;
 			break;
+		case Opt_lazy_sit:
+			set_opt(sbi, LAZY_SIT);
+			break;
+		case Opt_snapshot_cp:
+			set_opt(sbi, SNAPSHOT_CP);
+			break;
 		default:
 			f2fs_msg(sb, KERN_ERR,
 				"Unrecognized mount option \"%s\" or missing value",
@@ -587,6 +647,7 @@ static struct inode *f2fs_alloc_inode(struct super_block *sb)
 	mutex_init(&fi->inmem_lock);
 	init_rwsem(&fi->dio_rwsem[READ]);
 	init_rwsem(&fi->dio_rwsem[WRITE]);
+	spin_lock_init(&fi->node_cursor_lock);
 
 	/* Will be used by directory only */
 	fi->i_dir_level = F2FS_SB(sb)->dir_level;
@@ -806,9 +867,9 @@ int f2fs_sync_fs(struct super_block *sb, int sync)
 
 		cpc.reason = __get_cp_reason(sbi);
 
-		mutex_lock(&sbi->gc_mutex);
+		down_write(&sbi->gc_lock);
 		err = write_checkpoint(sbi, &cpc);
-		mutex_unlock(&sbi->gc_mutex);
+		up_write(&sbi->gc_lock);
 	}
 	f2fs_trace_ios(NULL, 1);
 
@@ -918,6 +979,10 @@ static int f2fs_show_options(struct seq_file *seq, struct dentry *root)
 		seq_puts(seq, ",noextent_cache");
 	if (test_opt(sbi, DATA_FLUSH))
 		seq_puts(seq, ",data_flush");
+	if (test_opt(sbi, LAZY_SIT))
+		seq_puts(seq, ",lazy_sit");
+	if (test_opt(sbi, SNAPSHOT_CP))
+		seq_puts(seq, ",snapshot_cp");
 
 	seq_puts(seq, ",mode=");
 	if (test_opt(sbi, ADAPTIVE))
@@ -970,6 +1035,10 @@ static int segment_bits_seq_show(struct seq_file *seq, void *offset)
 	for (i = 0; i < total_segs; i++) {
 		struct seg_entry *se = get_seg_entry(sbi, i);
 
+		mutex_lock(&SIT_I(sbi)->sentry_lock);
+		load_seg_entry(sbi, i);
+		mutex_unlock(&SIT_I(sbi)->sentry_lock);
+
 		seq_printf(seq, "%-10d", i);
 		seq_printf(seq, "%d|%-3u|", se->type,
 					get_valid_blocks(sbi, i, 1));
@@ -1780,6 +1849,7 @@ static int f2fs_scan_devices(struct f2fs_sb_info *sbi)
 		}
 
 		memcpy(FDEV(i).path, RDEV(i).path, MAX_PATH_LEN);
+		mutex_init(&FDEV(i).gc_mutex);
 		FDEV(i).total_segments = le32_to_cpu(RDEV(i).total_segments);
 		if (i == 0) {
 			FDEV(i).start_blk = 0;
@@ -1923,9 +1993,12 @@ try_onemore:
 
 	/* init f2fs-specific super block info */
 	sbi->valid_super_block = valid_super_block;
-	mutex_init(&sbi->gc_mutex);
+	init_rwsem(&sbi->gc_lock);
 	mutex_init(&sbi->cp_mutex);
 	init_rwsem(&sbi->node_write);
+	init_rwsem(&sbi->cp_commit_rwsem);
+	init_llist_head(&sbi->fsync_list);
+	mutex_init(&sbi->fsync_mutex);
 
 	/* disallow all the data/node/meta page writes */
 	set_sbi_flag(sbi, SBI_POR_DOING);